@@ -52,15 +52,18 @@ add_executable(pkgj
   ${assets}
   src/aes128.cpp
   src/bgdl.cpp
+  src/catalog.cpp
   src/comppackdb.cpp
   src/config.cpp
   src/db.cpp
   src/dialog.cpp
   src/download.cpp
   src/downloader.cpp
+  src/downloadqueue.cpp
   src/extractzip.cpp
   src/filedownload.cpp
   src/gameview.cpp
+  src/gzip.cpp
   src/patchinfo.cpp
   src/patchinfofetcher.cpp
   src/psx.cpp
@@ -69,10 +72,13 @@ add_executable(pkgj
   src/install.cpp
   src/menu.cpp
   src/pkgi.cpp
+  src/presence.cpp
   src/puff.c
+  src/refresher.cpp
   src/sfo.cpp
   src/sha256.cpp
   src/update.cpp
+  src/updatechecker.cpp
   src/vita.cpp
   src/vitafile.cpp
   src/vitahttp.cpp
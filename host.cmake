@@ -1,12 +1,20 @@
 find_package(SQLite3 REQUIRED)
+find_package(Threads REQUIRED)
+find_package(ZLIB REQUIRED)
 
 add_executable(pkgj_cli
   src/comppackdb.cpp
+  src/catalog.cpp
   src/db.cpp
   src/download.cpp
+  src/downloadqueue.cpp
   src/extractzip.cpp
   src/filedownload.cpp
+  src/gzip.cpp
   src/patchinfo.cpp
+  src/presence.cpp
+  src/refresher.cpp
+  src/updatechecker.cpp
   src/simulator.cpp
   src/aes128.cpp
   src/sfo.cpp
@@ -23,4 +31,6 @@ target_link_libraries(pkgj_cli
   SQLite::SQLite3
   cereal::cereal
   libzip::zip
+  Threads::Threads
+  ZLIB::ZLIB
 )
@@ -0,0 +1,537 @@
+#include "catalog.hpp"
+
+#include "pkgi.hpp"
+#include "sha256.hpp"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+
+namespace
+{
+// strcasestr only folds ASCII, so must the index
+uint8_t fold(char c)
+{
+    return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+uint32_t trigram(const char* s)
+{
+    return fold(s[0]) << 16 | fold(s[1]) << 8 | fold(s[2]);
+}
+
+// appends the trigrams of str to out
+void add_trigrams(std::vector<uint32_t>& out, std::string_view str)
+{
+    for (size_t i = 0; i + 3 <= str.size(); ++i)
+        out.push_back(trigram(str.data() + i));
+}
+
+void unique_trigrams(std::vector<uint32_t>& trigrams)
+{
+    std::sort(trigrams.begin(), trigrams.end());
+    trigrams.erase(
+            std::unique(trigrams.begin(), trigrams.end()), trigrams.end());
+}
+
+// packs the first bytes of str so that the keys compare like the strings,
+// up to ties
+uint64_t prefix_key(std::string_view str, bool folded = false)
+{
+    uint64_t key = 0;
+    for (size_t i = 0; i < 8; ++i)
+    {
+        uint8_t c = 0;
+        if (i < str.size())
+            c = folded ? fold(str[i]) : str[i];
+        key = key << 8 | c;
+    }
+    return key;
+}
+
+bool parse_digits(std::string_view str, size_t pos, size_t count, uint64_t& v)
+{
+    for (size_t i = pos; i < pos + count; ++i)
+    {
+        if (str[i] < '0' || str[i] > '9')
+            return false;
+        v = v * 10 + (str[i] - '0');
+    }
+    return true;
+}
+
+// parses "YYYY-MM-DD hh:mm:ss" into YYYYMMDDhhmmss, an empty date is 0
+bool parse_date(std::string_view date, uint64_t& key)
+{
+    key = 0;
+    if (date.empty())
+        return true;
+    return date.size() == 19 && date[4] == '-' && date[7] == '-' &&
+           date[10] == ' ' && date[13] == ':' && date[16] == ':' &&
+           parse_digits(date, 0, 4, key) && parse_digits(date, 5, 2, key) &&
+           parse_digits(date, 8, 2, key) && parse_digits(date, 11, 2, key) &&
+           parse_digits(date, 14, 2, key) && parse_digits(date, 17, 2, key);
+}
+
+struct KeyedRow
+{
+    uint64_t key;
+    uint32_t row;
+};
+
+// LSD radix sort on the keys, skipping the bytes that are the same for all
+// the rows
+void radix_sort(std::vector<KeyedRow>& rows)
+{
+    std::vector<KeyedRow> tmp(rows.size());
+    for (int shift = 0; shift < 64; shift += 8)
+    {
+        uint32_t counts[256] = {};
+        for (const auto& row : rows)
+            ++counts[(row.key >> shift) & 0xff];
+        if (counts[(rows[0].key >> shift) & 0xff] == rows.size())
+            continue;
+
+        uint32_t offset = 0;
+        for (auto& count : counts)
+            offset += std::exchange(count, offset);
+        for (const auto& row : rows)
+            tmp[counts[(row.key >> shift) & 0xff]++] = row;
+        rows.swap(tmp);
+    }
+}
+}
+
+void Catalog::clear()
+{
+    _arena.clear();
+    _titleid.clear();
+    _name.clear();
+    _date.clear();
+    _size.clear();
+    _region.clear();
+    _game_region.clear();
+    _name_key.clear();
+    _date_key.clear();
+    _date_key_parsed = true;
+    _cold.clear();
+    _digests.clear();
+    _flags.clear();
+    _trigrams.clear();
+    _trigram_offsets.clear();
+    _trigram_rows.clear();
+    _content_index = LookupIndex{};
+    _titleid_index = LookupIndex{};
+}
+
+void Catalog::reserve(uint32_t rows, uint32_t arena_size)
+{
+    _arena.reserve(arena_size);
+    _titleid.reserve(rows);
+    _name.reserve(rows);
+    _date.reserve(rows);
+    _size.reserve(rows);
+    _region.reserve(rows);
+    _game_region.reserve(rows);
+    _name_key.reserve(rows);
+    _date_key.reserve(rows);
+    _cold.reserve(rows);
+    _digests.reserve(rows);
+    _flags.reserve(rows);
+}
+
+void Catalog::shrink_to_fit()
+{
+    _arena.shrink_to_fit();
+    _titleid.shrink_to_fit();
+    _name.shrink_to_fit();
+    _date.shrink_to_fit();
+    _size.shrink_to_fit();
+    _region.shrink_to_fit();
+    _game_region.shrink_to_fit();
+    _name_key.shrink_to_fit();
+    _date_key.shrink_to_fit();
+    _cold.shrink_to_fit();
+    _digests.shrink_to_fit();
+    _flags.shrink_to_fit();
+}
+
+size_t Catalog::memory_usage() const
+{
+    return _arena.capacity() +
+           (_titleid.capacity() + _name.capacity() + _date.capacity()) *
+                   sizeof(StrRef) +
+           _size.capacity() * sizeof(int64_t) + _region.capacity() +
+           _game_region.capacity() +
+           (_name_key.capacity() + _date_key.capacity()) * sizeof(uint64_t) +
+           _cold.capacity() * sizeof(ColdRow) +
+           _digests.capacity() * sizeof(_digests[0]) + _flags.capacity() +
+           (_trigrams.capacity() + _trigram_offsets.capacity() +
+            _trigram_rows.capacity() + _content_index.slots.capacity() +
+            _content_index.next.capacity() + _titleid_index.slots.capacity() +
+            _titleid_index.next.capacity()) *
+                   sizeof(uint32_t);
+}
+
+Catalog::StrRef Catalog::store(std::string_view str)
+{
+    if (_arena.size() + str.size() + 1 > UINT32_MAX)
+        throw std::runtime_error("lista demasiado grande");
+
+    const StrRef ref{
+            static_cast<uint32_t>(_arena.size()),
+            static_cast<uint32_t>(str.size())};
+    _arena.insert(_arena.end(), str.begin(), str.end());
+    // keep the strings null-terminated so that they can be given to C APIs
+    _arena.push_back('\0');
+    return ref;
+}
+
+void Catalog::add(const DbItem& item, uint32_t region)
+{
+    _titleid.push_back(store(item.titleid));
+    _name.push_back(store(item.name));
+    _date.push_back(store(item.date));
+    _size.push_back(item.size);
+    _region.push_back(region);
+
+    _game_region.push_back(pkgi_get_region(item.titleid));
+    _name_key.push_back(prefix_key(item.name, true));
+    uint64_t date;
+    if (!parse_date(item.date, date))
+        _date_key_parsed = false;
+    _date_key.push_back(date);
+
+    int32_t digest = -1;
+    if (item.digest)
+    {
+        digest = _digests.size();
+        _digests.emplace_back();
+        std::copy(
+                item.digest,
+                item.digest + SHA256_DIGEST_SIZE,
+                _digests.back().begin());
+    }
+
+    _cold.push_back(ColdRow{
+            store(item.content),
+            store(item.name_org),
+            store(item.zrif),
+            store(item.url),
+            store(item.app_version),
+            store(item.fw_version),
+            digest,
+    });
+    _flags.push_back(item.flags);
+}
+
+DbItem Catalog::get(uint32_t row) const
+{
+    const auto& cold = _cold[row];
+    return DbItem{
+            PresenceUnknown,
+            titleid(row),
+            content(row),
+            _flags[row],
+            name(row),
+            str(cold.name_org),
+            str(cold.zrif),
+            str(cold.url),
+            cold.digest < 0 ? nullptr : _digests[cold.digest].data(),
+            _size[row],
+            date(row),
+            str(cold.app_version),
+            str(cold.fw_version),
+    };
+}
+
+void Catalog::build_search_index()
+{
+    _trigrams.clear();
+    _trigram_offsets.clear();
+    _trigram_rows.clear();
+
+    std::vector<uint32_t> row_trigrams;
+    const auto for_each_row = [&](auto f) {
+        for (uint32_t row = 0; row < size(); ++row)
+        {
+            row_trigrams.clear();
+            add_trigrams(row_trigrams, name(row));
+            add_trigrams(row_trigrams, titleid(row));
+            unique_trigrams(row_trigrams);
+            for (const auto t : row_trigrams)
+                f(t, row);
+        }
+    };
+
+    // first pass counts the rows of each trigram to size the posting lists
+    std::unordered_map<uint32_t, uint32_t> counts;
+    for_each_row([&](uint32_t t, uint32_t) { ++counts[t]; });
+
+    _trigrams.reserve(counts.size());
+    for (const auto& count : counts)
+        _trigrams.push_back(count.first);
+    std::sort(_trigrams.begin(), _trigrams.end());
+
+    // reuse the map to store where the next row of each trigram goes
+    _trigram_offsets.reserve(_trigrams.size() + 1);
+    uint32_t offset = 0;
+    for (const auto t : _trigrams)
+    {
+        _trigram_offsets.push_back(offset);
+        offset += std::exchange(counts[t], offset);
+    }
+    _trigram_offsets.push_back(offset);
+
+    // rows are visited in order, so the posting lists come out sorted
+    _trigram_rows.resize(offset);
+    for_each_row([&](uint32_t t, uint32_t row) {
+        _trigram_rows[counts[t]++] = row;
+    });
+}
+
+bool Catalog::matches(uint32_t row, const char* search) const
+{
+    return pkgi_stricontains(name(row).data(), search) ||
+           pkgi_stricontains(titleid(row).data(), search);
+}
+
+std::vector<uint32_t> Catalog::search(
+        const std::string& search,
+        const std::vector<uint32_t>* candidates) const
+{
+    std::vector<uint32_t> result;
+
+    if (candidates)
+    {
+        for (const auto row : *candidates)
+            if (matches(row, search.c_str()))
+                result.push_back(row);
+        return result;
+    }
+
+    std::vector<uint32_t> trigrams;
+    add_trigrams(trigrams, search);
+    unique_trigrams(trigrams);
+
+    if (trigrams.empty())
+    {
+        // too short for the index
+        for (uint32_t row = 0; row < size(); ++row)
+            if (matches(row, search.c_str()))
+                result.push_back(row);
+        return result;
+    }
+
+    struct Posting
+    {
+        const uint32_t* begin;
+        const uint32_t* end;
+    };
+    std::vector<Posting> postings;
+    postings.reserve(trigrams.size());
+    for (const auto t : trigrams)
+    {
+        const auto it = std::lower_bound(_trigrams.begin(), _trigrams.end(), t);
+        if (it == _trigrams.end() || *it != t)
+            return result;
+        const auto i = it - _trigrams.begin();
+        postings.push_back(Posting{
+                _trigram_rows.data() + _trigram_offsets[i],
+                _trigram_rows.data() + _trigram_offsets[i + 1]});
+    }
+
+    // intersect starting from the shortest list so that the candidate set
+    // only shrinks
+    std::sort(
+            postings.begin(),
+            postings.end(),
+            [](const Posting& a, const Posting& b) {
+                return a.end - a.begin < b.end - b.begin;
+            });
+
+    std::vector<uint32_t> rows(postings[0].begin, postings[0].end);
+    for (size_t i = 1; i < postings.size() && !rows.empty(); ++i)
+    {
+        auto out = rows.begin();
+        const uint32_t* p = postings[i].begin;
+        for (const auto row : rows)
+        {
+            p = std::lower_bound(p, postings[i].end, row);
+            if (p == postings[i].end)
+                break;
+            if (*p == row)
+                *out++ = row;
+        }
+        rows.erase(out, rows.end());
+    }
+
+    // the trigrams may come from different places in the strings
+    for (const auto row : rows)
+        if (matches(row, search.c_str()))
+            result.push_back(row);
+    return result;
+}
+
+uint64_t Catalog::sort_key(uint32_t row, DbSort sort) const
+{
+    switch (sort)
+    {
+    case SortByTitle:
+        return prefix_key(titleid(row));
+    case SortByRegion:
+        return uint64_t(_game_region[row]) << 56 |
+               prefix_key(titleid(row)) >> 8;
+    case SortByName:
+        return _name_key[row];
+    case SortBySize:
+        return uint64_t(_size[row]) ^ (uint64_t(1) << 63);
+    case SortByDate:
+        return _date_key_parsed ? _date_key[row] : prefix_key(date(row));
+    }
+    throw std::runtime_error(fmt::format("orden desconocido {}", (int)sort));
+}
+
+int Catalog::compare(uint32_t a, uint32_t b, DbSort sort) const
+{
+    int cmp = 0;
+    if (sort == SortByRegion)
+        cmp = _game_region[a] - _game_region[b];
+    else if (sort == SortByName)
+        cmp = pkgi_stricmp(name(a).data(), name(b).data());
+    else if (sort == SortBySize)
+        cmp = _size[a] < _size[b] ? -1 : _size[a] > _size[b];
+    else if (sort == SortByDate)
+        cmp = date(a).compare(date(b));
+
+    if (cmp == 0)
+        cmp = titleid(a).compare(titleid(b));
+
+    return cmp;
+}
+
+void Catalog::sort(
+        std::vector<uint32_t>& rows, DbSort sort, DbSortOrder order) const
+{
+    if (rows.empty())
+        return;
+
+    std::vector<KeyedRow> keyed;
+    keyed.reserve(rows.size());
+    for (const auto row : rows)
+        keyed.push_back(KeyedRow{sort_key(row, sort), row});
+
+    radix_sort(keyed);
+
+    // the keys only hold a prefix of the names, title ids and unparsed
+    // dates, the rows with the same key are sorted with the full comparison
+    for (auto begin = keyed.begin(); begin != keyed.end();)
+    {
+        const auto end = std::find_if(
+                begin + 1,
+                keyed.end(),
+                [&](const KeyedRow& r) { return r.key != begin->key; });
+        if (end - begin > 1)
+            std::sort(
+                    begin,
+                    end,
+                    [&](const KeyedRow& a, const KeyedRow& b)
+                    { return compare(a.row, b.row, sort) < 0; });
+        begin = end;
+    }
+
+    if (order == SortDescending)
+        std::transform(
+                keyed.rbegin(),
+                keyed.rend(),
+                rows.begin(),
+                [](const KeyedRow& r) { return r.row; });
+    else
+        std::transform(
+                keyed.begin(),
+                keyed.end(),
+                rows.begin(),
+                [](const KeyedRow& r) { return r.row; });
+}
+
+template <typename Key>
+void Catalog::build_index(LookupIndex& index, Key key)
+{
+    // keep the table at most half full
+    size_t slots = 16;
+    while (slots < size() * 2)
+        slots *= 2;
+    index.slots.assign(slots, 0);
+    index.next.assign(size(), UINT32_MAX);
+
+    const std::hash<std::string_view> hash;
+    // rows are inserted backward at the head of their chain so that chains
+    // come out in list order
+    for (uint32_t row = size(); row-- > 0;)
+    {
+        const auto value = key(row);
+        for (size_t i = hash(value) & (slots - 1);; i = (i + 1) & (slots - 1))
+        {
+            if (index.slots[i] == 0)
+            {
+                index.slots[i] = row + 1;
+                break;
+            }
+            if (key(index.slots[i] - 1) == value)
+            {
+                index.next[row] = index.slots[i] - 1;
+                index.slots[i] = row + 1;
+                break;
+            }
+        }
+    }
+}
+
+template <typename Key>
+uint32_t Catalog::lookup(
+        const LookupIndex& index, Key key, std::string_view value) const
+{
+    if (index.slots.empty())
+        return UINT32_MAX;
+
+    const auto mask = index.slots.size() - 1;
+    for (size_t i = std::hash<std::string_view>()(value) & mask;
+         index.slots[i] != 0;
+         i = (i + 1) & mask)
+        if (key(index.slots[i] - 1) == value)
+            return index.slots[i] - 1;
+    return UINT32_MAX;
+}
+
+void Catalog::build_lookup_index()
+{
+    build_index(_content_index, [&](uint32_t row) { return content(row); });
+    build_index(_titleid_index, [&](uint32_t row) { return titleid(row); });
+}
+
+std::optional<uint32_t> Catalog::find_content(std::string_view content) const
+{
+    const auto row = lookup(
+            _content_index,
+            [&](uint32_t row) { return this->content(row); },
+            content);
+    if (row == UINT32_MAX)
+        return std::nullopt;
+    return row;
+}
+
+std::vector<uint32_t> Catalog::find_titleid(std::string_view titleid) const
+{
+    std::vector<uint32_t> rows;
+    for (auto row = lookup(
+                 _titleid_index,
+                 [&](uint32_t row) { return this->titleid(row); },
+                 titleid);
+         row != UINT32_MAX;
+         row = _titleid_index.next[row])
+        rows.push_back(row);
+    return rows;
+}
@@ -0,0 +1,175 @@
+#pragma once
+
+#include "db.hpp"
+
+#include <array>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <cstdint>
+
+// Parsed content of a title list.
+//
+// All the strings of the list live back to back in a single arena and the
+// rows are stored column by column. The columns used to sort and filter the
+// list are kept apart from the ones that are only needed to display or
+// install an item.
+class Catalog
+{
+public:
+    void clear();
+    void reserve(uint32_t rows, uint32_t arena_size);
+    void shrink_to_fit();
+
+    // copies the strings of item into the arena, region is the DbFilterRegion
+    // flag of the region column of the list
+    void add(const DbItem& item, uint32_t region);
+
+    // must be called once all the rows are added
+    void build_search_index();
+    void build_lookup_index();
+
+    std::optional<uint32_t> find_content(std::string_view content) const;
+    // rows with this title id, in list order
+    std::vector<uint32_t> find_titleid(std::string_view titleid) const;
+
+    // returns the rows whose name or title id contain search, ignoring case.
+    // If candidates is given, only those rows are considered.
+    std::vector<uint32_t> search(
+            const std::string& search,
+            const std::vector<uint32_t>* candidates = nullptr) const;
+
+    // sorts rows by sort, ties are broken by title id
+    void sort(std::vector<uint32_t>& rows, DbSort sort, DbSortOrder order)
+            const;
+
+    // full comparison of two rows, as done by sort
+    int compare(uint32_t a, uint32_t b, DbSort sort) const;
+
+    uint32_t size() const
+    {
+        return _titleid.size();
+    }
+
+    size_t memory_usage() const;
+
+    std::string_view titleid(uint32_t row) const
+    {
+        return str(_titleid[row]);
+    }
+
+    std::string_view content(uint32_t row) const
+    {
+        return str(_cold[row].content);
+    }
+
+    std::string_view name(uint32_t row) const
+    {
+        return str(_name[row]);
+    }
+
+    std::string_view date(uint32_t row) const
+    {
+        return str(_date[row]);
+    }
+
+    int64_t item_size(uint32_t row) const
+    {
+        return _size[row];
+    }
+
+    uint32_t region(uint32_t row) const
+    {
+        return _region[row];
+    }
+
+    std::string_view zrif(uint32_t row) const
+    {
+        return str(_cold[row].zrif);
+    }
+
+    // adds DbItemFlags to the row
+    void add_flags(uint32_t row, uint32_t flags)
+    {
+        _flags[row] |= flags;
+    }
+
+    DbItem get(uint32_t row) const;
+
+private:
+    struct StrRef
+    {
+        uint32_t offset;
+        uint32_t size;
+    };
+
+    struct ColdRow
+    {
+        StrRef content;
+        StrRef name_org;
+        StrRef zrif;
+        StrRef url;
+        StrRef app_version;
+        StrRef fw_version;
+        int32_t digest;
+    };
+
+    std::vector<char> _arena;
+
+    // sort and filter keys
+    std::vector<StrRef> _titleid;
+    std::vector<StrRef> _name;
+    std::vector<StrRef> _date;
+    std::vector<int64_t> _size;
+    std::vector<uint8_t> _region;
+
+    // sort keys, computed when the row is added. A key is an integer whose
+    // order is the one of the field it comes from, possibly with ties that
+    // compare() has to break.
+    std::vector<uint8_t> _game_region;
+    std::vector<uint64_t> _name_key;
+    std::vector<uint64_t> _date_key;
+    // false if a date could not be parsed, the date keys are then made from
+    // the first bytes of the dates instead
+    bool _date_key_parsed = true;
+
+    std::vector<ColdRow> _cold;
+    std::vector<std::array<uint8_t, 32>> _digests;
+    std::vector<uint8_t> _flags;
+
+    // trigram index of the case-folded names and title ids, the rows
+    // containing _trigrams[i] are
+    // _trigram_rows[_trigram_offsets[i]:_trigram_offsets[i + 1]]
+    std::vector<uint32_t> _trigrams;
+    std::vector<uint32_t> _trigram_offsets;
+    std::vector<uint32_t> _trigram_rows;
+
+    // open addressing hash table of the rows keyed by a column, rows with
+    // the same key are chained through next
+    struct LookupIndex
+    {
+        std::vector<uint32_t> slots; // row + 1, 0 when empty
+        std::vector<uint32_t> next;  // UINT32_MAX at the end of a chain
+    };
+
+    LookupIndex _content_index;
+    LookupIndex _titleid_index;
+
+    template <typename Key>
+    void build_index(LookupIndex& index, Key key);
+    template <typename Key>
+    uint32_t lookup(
+            const LookupIndex& index, Key key, std::string_view value) const;
+
+    bool matches(uint32_t row, const char* search) const;
+    uint64_t sort_key(uint32_t row, DbSort sort) const;
+
+    StrRef store(std::string_view str);
+
+    std::string_view str(StrRef ref) const
+    {
+        return std::string_view(_arena.data() + ref.offset, ref.size);
+    }
+};
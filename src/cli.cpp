@@ -1,22 +1,50 @@
+#include "catalog.hpp"
 #include "comppackdb.hpp"
 #include "db.hpp"
 #include "download.hpp"
+#include "downloadqueue.hpp"
 #include "extractzip.hpp"
+#include "file.hpp"
 #include "filedownload.hpp"
 #include "filehttp.hpp"
 #include "patchinfo.hpp"
+#include "pkgi.hpp"
+#include "presence.hpp"
+#include "refresher.hpp"
+#include "tsv.hpp"
+#include "updatechecker.hpp"
 #include "zrif.hpp"
 
 #include <boost/algorithm/hex.hpp>
 
 #include <fmt/format.h>
 
+#include <malloc.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <fstream>
 #include <memory>
+#include <numeric>
+#include <regex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
 
 static constexpr auto USAGE =
-        "Uso: %s [extract <filename> <zrif> <sha256>] [refreshlist PSV "
-        "path] [refreshcomppack path] [filedownload path] [extractzip path] "
-        "[patchinfo xmlfile titleid]\n";
+        "Uso: %s [extract <filename> <zrif> <sha256>] [refreshlist dir "
+        "[workers] [KB/s]] [refreshcomppack path] [filedownload path] "
+        "[extractzip path] [patchinfo xmlfile titleid] [sortbench PSV path] "
+        "[lookupbench PSV path] [parsebench PSV path] "
+        "[searchbench dir search...] [presence dir content...] "
+        "[queuebench count] [comppackbench path] "
+        "[comppacklookupbench path] [comppackloadbench path...] "
+        "[comppackinstallbench zip] [resumedownload path bytes] "
+        "[resumestream zip bytes] "
+        "[zrifbench PSV path [workers]] "
+        "[updatecheck dir titles [workers] [ttl]]\n";
 
 int extract(int argc, char* argv[])
 {
@@ -47,32 +75,116 @@ int extract(int argc, char* argv[])
     return 0;
 }
 
+template <typename F>
+double time_ms(F f)
+{
+    const auto start = std::chrono::steady_clock::now();
+    f();
+    return std::chrono::duration<double, std::milli>(
+                   std::chrono::steady_clock::now() - start)
+            .count();
+}
+
+static const std::pair<const char*, Mode> MODE_ARGS[] = {
+        {"PSVGAMES", ModeGames},
+        {"PSVDLCS", ModeDlcs},
+        {"PSVDEMOS", ModeDemos},
+        {"PSVTHEMES", ModeThemes},
+        {"PSMGAMES", ModePsmGames},
+        {"PSXGAMES", ModePsxGames},
+        {"PSPGAMES", ModePspGames},
+        {"PSPDLCS", ModePspDlcs},
+};
+
 Mode arg_to_mode(std::string const& arg)
 {
-    if (arg == "PSVGAMES")
-        return ModeGames;
-    else
-        throw std::runtime_error("arg. no soportado: " + arg);
+    for (const auto& mode_arg : MODE_ARGS)
+        if (arg == mode_arg.first)
+            return mode_arg.second;
+    throw std::runtime_error("arg. no soportado: " + arg);
 }
 
+// stand-in for a remote server: every request has some latency and each
+// connection is limited to a given bandwidth
+class SlowHttp : public FileHttp
+{
+public:
+    SlowHttp(unsigned kbps) : _kbps(kbps)
+    {
+    }
+
+    void start(const std::string& url, uint64_t offset) override
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        FileHttp::start(url, offset);
+    }
+
+    int64_t read(uint8_t* buffer, uint64_t size) override
+    {
+        const auto read = FileHttp::read(buffer, size);
+        if (_kbps != 0)
+            std::this_thread::sleep_for(
+                    std::chrono::microseconds(read * 1000000 / 1024 / _kbps));
+        return read;
+    }
+
+private:
+    unsigned _kbps;
+};
+
+// refreshes the lists found in dir, named after the modes (PSVGAMES.tsv...)
+// and entries.txt/entries_patch.txt for comp packs
 int refreshlist(int argc, char* argv[])
 {
-    if (argc != 4)
+    if (argc < 3 || argc > 5)
     {
         printf(USAGE, argv[0]);
         return 1;
     }
 
-    const auto http = std::make_unique<FileHttp>();
-
-    const auto mode = arg_to_mode(argv[2]);
+    const std::string dir = argv[2];
+    const unsigned workers = argc > 3 ? std::stoul(argv[3]) : 3;
+    const unsigned kbps = argc > 4 ? std::stoul(argv[4]) : 0;
 
     const auto db = std::make_unique<TitleDatabase>(".");
-    db->update(mode, http.get(), argv[3]);
-    db->reload(mode, DbFilterAllRegions, SortBySize, SortDescending, "the", {});
-    for (unsigned int i = 0; i < db->count(); ++i)
-        fmt::print("{}: {}\n", db->get(i)->name, db->get(i)->size);
-    fmt::print("{}/{}\n", db->count(), db->total());
+    const auto comppack_db = std::make_unique<CompPackDatabase>("comppack.db");
+    const auto comppack_updates_db =
+            std::make_unique<CompPackDatabase>("comppack_updates.db");
+
+    std::vector<Refresher::Source> sources;
+    for (const auto& mode_arg : MODE_ARGS)
+    {
+        const auto mode = mode_arg.second;
+        const auto url = fmt::format("{}/{}.tsv", dir, mode_arg.first);
+        if (pkgi_file_exists(url))
+            sources.push_back(Refresher::Source{
+                    mode_arg.first,
+                    [&, mode, url](Http* http, const auto& progress)
+                    { db->update(mode, http, url, progress); }});
+    }
+    for (const auto& [name, comppack] :
+         {std::make_pair("entries.txt", comppack_db.get()),
+          std::make_pair("entries_patch.txt", comppack_updates_db.get())})
+    {
+        const auto url = fmt::format("{}/{}", dir, name);
+        if (pkgi_file_exists(url))
+            sources.push_back(Refresher::Source{
+                    name,
+                    [comppack = comppack, url](
+                            Http* http, const auto& progress)
+                    { comppack->update(http, url, progress); }});
+    }
+
+    Refresher refresher(
+            [&] { return std::make_unique<SlowHttp>(kbps); },
+            std::move(sources),
+            workers);
+
+    const auto ms = time_ms([&] { refresher.run(); });
+
+    for (const auto& status : refresher.get_status())
+        fmt::print("{}: {} bytes\n", status.name, status.downloaded);
+    fmt::print("{} listas en {:.0f} ms\n", refresher.get_status().size(), ms);
 
     return 0;
 }
@@ -143,6 +255,900 @@ int patchinfo(int argc, char* argv[])
     return 0;
 }
 
+std::unique_ptr<TitleDatabase> load_bench_list(
+        const std::string& mode_arg, const std::string& path)
+{
+    const auto http = std::make_unique<FileHttp>();
+
+    const auto mode = arg_to_mode(mode_arg);
+
+    auto db = std::make_unique<TitleDatabase>(".");
+    db->update(mode, http.get(), path);
+    db->reload(mode, DbFilterAllRegions, SortByTitle, SortAscending, "", {});
+    return db;
+}
+
+// compares sorting the list with the comparator pkgj used to have against
+// the sort keys of the catalog
+int sortbench(int argc, char* argv[])
+{
+    if (argc != 4)
+    {
+        printf(USAGE, argv[0]);
+        return 1;
+    }
+
+    const auto db = load_bench_list(argv[2], argv[3]);
+
+    Catalog catalog;
+    for (unsigned int i = 0; i < db->count(); ++i)
+        catalog.add(*db->get(i), 0);
+
+    const auto comparator = [&](DbSort sort, uint32_t a, uint32_t b)
+    {
+        const auto ta = catalog.titleid(a);
+        const auto tb = catalog.titleid(b);
+        int64_t cmp = 0;
+        if (sort == SortByTitle)
+            cmp = ta.compare(tb);
+        else if (sort == SortByRegion)
+            cmp = pkgi_get_region(ta) - pkgi_get_region(tb);
+        else if (sort == SortByName)
+            cmp = pkgi_stricmp(
+                    catalog.name(a).data(), catalog.name(b).data());
+        else if (sort == SortBySize)
+            cmp = catalog.item_size(a) - catalog.item_size(b);
+        else if (sort == SortByDate)
+            cmp = catalog.date(a).compare(catalog.date(b));
+        if (cmp == 0)
+            cmp = ta.compare(tb);
+        return cmp < 0;
+    };
+
+    const char* names[] = {"titulo", "region", "nombre", "tamano", "fecha"};
+    for (const auto sort :
+         {SortByTitle, SortByRegion, SortByName, SortBySize, SortByDate})
+    {
+        std::vector<uint32_t> shuffled(catalog.size());
+        std::iota(shuffled.begin(), shuffled.end(), 0);
+        std::reverse(shuffled.begin(), shuffled.end());
+
+        auto by_comparator = shuffled;
+        const auto comparator_ms = time_ms(
+                [&]
+                {
+                    std::sort(
+                            by_comparator.begin(),
+                            by_comparator.end(),
+                            [&](uint32_t a, uint32_t b)
+                            { return comparator(sort, a, b); });
+                });
+
+        auto by_keys = shuffled;
+        const auto keys_ms = time_ms(
+                [&] { catalog.sort(by_keys, sort, SortAscending); });
+
+        fmt::print(
+                "{}: comparador {:.1f} ms, claves {:.1f} ms{}\n",
+                names[sort],
+                comparator_ms,
+                keys_ms,
+                by_comparator == by_keys ? "" : " (orden distinto)");
+    }
+
+    return 0;
+}
+
+// compares looking up every content id and title id of the list by scanning
+// it, as pkgj used to, against the hash indexes
+int lookupbench(int argc, char* argv[])
+{
+    if (argc != 4)
+    {
+        printf(USAGE, argv[0]);
+        return 1;
+    }
+
+    const auto db = load_bench_list(argv[2], argv[3]);
+
+    std::vector<std::string> contents;
+    std::vector<std::string> titleids;
+    for (unsigned int i = 0; i < db->count(); ++i)
+    {
+        contents.emplace_back(db->get(i)->content);
+        titleids.emplace_back(db->get(i)->titleid);
+    }
+
+    // scanning is quadratic, only time a sample
+    const size_t sample = std::min<size_t>(contents.size(), 1000);
+
+    size_t found = 0;
+    const auto scan_ms = time_ms(
+            [&]
+            {
+                for (size_t i = 0; i < sample; ++i)
+                {
+                    for (unsigned int j = 0; j < db->count(); ++j)
+                        if (db->get(j)->content == contents[i])
+                        {
+                            ++found;
+                            break;
+                        }
+                    for (unsigned int j = 0; j < db->count(); ++j)
+                        found += db->get(j)->titleid == titleids[i];
+                }
+            });
+
+    size_t indexed_found = 0;
+    const auto index_ms = time_ms(
+            [&]
+            {
+                for (size_t i = 0; i < sample; ++i)
+                    indexed_found += db->find_by_content(contents[i]).size() +
+                                     db->find_by_titleid(titleids[i]).size();
+            });
+
+    const auto all_ms = time_ms(
+            [&]
+            {
+                for (size_t i = 0; i < contents.size(); ++i)
+                {
+                    db->get_by_content(contents[i].c_str());
+                    db->find_by_titleid(titleids[i]);
+                }
+            });
+
+    fmt::print(
+            "{} busquedas: recorrido {:.1f} ms, indice {:.2f} ms{}\n",
+            sample * 2,
+            scan_ms,
+            index_ms,
+            found == indexed_found ? "" : " (resultados distintos)");
+    fmt::print(
+            "{} busquedas con indice: {:.1f} ms\n",
+            contents.size() * 2,
+            all_ms);
+
+    return 0;
+}
+
+// parse throughput of a list, best of a few runs
+int parsebench(int argc, char* argv[])
+{
+    if (argc != 4)
+    {
+        printf(USAGE, argv[0]);
+        return 1;
+    }
+
+    const auto mode = arg_to_mode(argv[2]);
+    const auto data = pkgi_load(argv[3]);
+    const auto begin = reinterpret_cast<const char*>(data.data());
+    const auto end = begin + data.size();
+
+    const auto best_mb_s = [&](auto f)
+    {
+        double best = 1e9;
+        for (int i = 0; i < 5; ++i)
+            best = std::min(best, time_ms(f));
+        return data.size() / 1000.0 / best;
+    };
+
+    // how rows used to be split, byte by byte into a vector per row
+    size_t byte_fields = 0;
+    const auto byte_mb_s = best_mb_s(
+            [&]
+            {
+                byte_fields = 0;
+                for (const char* row = begin; row < end;)
+                {
+                    std::vector<const char*> fields{row};
+                    const char* ptr = row;
+                    for (; ptr != end && *ptr != '\n'; ++ptr)
+                        if (*ptr == '\t' || *ptr == '\r')
+                            fields.push_back(ptr + 1);
+                    byte_fields += fields.size();
+                    row = ptr + 1;
+                }
+            });
+
+    size_t tsv_fields = 0;
+    const auto tsv_mb_s = best_mb_s(
+            [&]
+            {
+                tsv_fields = 0;
+                TsvRow row;
+                row.start(begin);
+                for (const char* ptr = begin;;)
+                {
+                    const auto delimiter = pkgi_find_tsv_delimiter(ptr, end);
+                    if (delimiter == end)
+                        break;
+                    ptr = delimiter + 1;
+                    if (*delimiter == '\n')
+                    {
+                        tsv_fields += row.size();
+                        row.start(ptr);
+                    }
+                    else
+                        row.add(ptr);
+                }
+                if (end[-1] != '\n')
+                    tsv_fields += row.size();
+            });
+
+    size_t rows = 0;
+    const auto parse_mb_s = best_mb_s(
+            [&]
+            {
+                Catalog catalog;
+                pkgi_parse_catalog(mode, begin, data.size(), catalog);
+                rows = catalog.size();
+            });
+
+    fmt::print(
+            "division: byte a byte {:.0f} MB/s, tsv {:.0f} MB/s{}\n",
+            byte_mb_s,
+            tsv_mb_s,
+            byte_fields == tsv_fields ? "" : " (campos distintos)");
+    fmt::print("parseo: {} objetos, {:.0f} MB/s\n", rows, parse_mb_s);
+
+    return 0;
+}
+
+// searches the lists downloaded by refreshlist in dir in all the modes at
+// once
+int searchbench(int argc, char* argv[])
+{
+    if (argc < 4)
+    {
+        printf(USAGE, argv[0]);
+        return 1;
+    }
+
+    TitleDatabase db(argv[2]);
+
+    const auto load_ms = time_ms([&] { db.search_all(""); });
+    fmt::print(
+            "carga de las listas: {:.0f} ms, {} KB\n",
+            load_ms,
+            db.memory_usage() / 1024);
+
+    for (int i = 3; i < argc; ++i)
+    {
+        const std::string search = argv[i];
+        std::vector<DbModeMatches> matches;
+        constexpr auto runs = 20;
+        const auto search_ms = time_ms(
+                [&]
+                {
+                    for (int run = 0; run < runs; ++run)
+                        matches = db.search_all(search);
+                });
+
+        uint32_t total = 0;
+        for (const auto& mode_matches : matches)
+            total += mode_matches.count;
+        fmt::print(
+                "\"{}\": {} resultados en {:.2f} ms\n",
+                search,
+                total,
+                search_ms / runs);
+        for (const auto& mode_matches : matches)
+            fmt::print(
+                    "  {}: {}\n",
+                    pkgi_mode_to_string(mode_matches.mode),
+                    mode_matches.count);
+    }
+
+    return 0;
+}
+
+// scans dir, laid out like ux0:, and prints what is installed of each
+// content id
+int presence(int argc, char* argv[])
+{
+    if (argc < 3)
+    {
+        printf(USAGE, argv[0]);
+        return 1;
+    }
+
+    const std::string partition = std::string(argv[2]) + "/";
+
+    PresenceIndex index;
+    const auto scan_ms = time_ms([&] { index.scan(partition, partition); });
+    fmt::print("escaneo: {:.2f} ms\n", scan_ms);
+
+    for (int i = 3; i < argc; ++i)
+    {
+        const std::string_view content = argv[i];
+        const auto titleid = content.substr(7, 9);
+        std::string found;
+        const auto add = [&](bool present, const char* what)
+        {
+            if (present)
+                found += fmt::format(" {}", what);
+        };
+        add(index.game_installed(titleid), "juego");
+        add(index.psm_installed(titleid), "psm");
+        add(index.dlc_installed(content), "dlc");
+        add(index.theme_installed(content), "tema");
+        add(index.psp_installed(content), "psp");
+        add(index.psx_installed(content), "psx");
+        add(index.incomplete(partition, content), "incompleto");
+        fmt::print("{}:{}\n", content, found.empty() ? " nada" : found);
+    }
+
+    return 0;
+}
+
+// compares checking whether every row of a list is queued by scanning the
+// queue, as pkgj used to, against the keys of DownloadQueue
+int queuebench(int argc, char* argv[])
+{
+    if (argc != 3)
+    {
+        printf(USAGE, argv[0]);
+        return 1;
+    }
+
+    const auto count = std::stoul(argv[2]);
+
+    DownloadQueue queue;
+    std::deque<DownloadItem> items;
+    std::vector<DownloadItem> rows;
+    for (unsigned long i = 0; i < count * 2; ++i)
+    {
+        DownloadItem item{};
+        item.type = static_cast<Type>(i % (PspDlc + 1));
+        item.content = fmt::format("UP0000-PCSE{:05}_00-{:016X}", i / 2, i);
+        // half of the rows are queued
+        if (i % 2 == 0)
+        {
+            queue.push(item);
+            items.push_back(item);
+        }
+        rows.push_back(std::move(item));
+    }
+
+    size_t scan_found = 0;
+    const auto scan_ms = time_ms(
+            [&]
+            {
+                for (const auto& row : rows)
+                    for (const auto& item : items)
+                        if (item.type == row.type &&
+                            item.content == row.content)
+                        {
+                            ++scan_found;
+                            break;
+                        }
+            });
+
+    size_t found = 0;
+    const auto keys_ms = time_ms(
+            [&]
+            {
+                for (const auto& row : rows)
+                    found += queue.contains(row.type, row.content);
+            });
+
+    // the queue must still answer right once items move through it
+    const auto generation = queue.generation();
+    queue.start_next();
+    const bool current_kept = queue.contains(rows[0].type, rows[0].content);
+    queue.finish_current();
+    const bool current_removed =
+            !queue.contains(rows[0].type, rows[0].content);
+    queue.remove(rows[2].type, rows[2].content);
+    const bool removed = !queue.contains(rows[2].type, rows[2].content) &&
+                         queue.contains(rows[4].type, rows[4].content);
+
+    fmt::print(
+            "{} filas, {} en cola: recorrido {:.1f} ms, claves {:.2f} ms{}\n",
+            rows.size(),
+            items.size(),
+            scan_ms,
+            keys_ms,
+            found == scan_found ? "" : " (resultados distintos)");
+    fmt::print(
+            "generacion {} -> {}, {}\n",
+            generation,
+            queue.generation(),
+            current_kept && current_removed && removed ? "cola correcta"
+                                                       : "cola incorrecta");
+
+    return 0;
+}
+
+// compares finding the title id and version of every line of a comp pack
+// list with the regex pkgj used to have against pkgi_parse_comppack_name
+int comppackbench(int argc, char* argv[])
+{
+    if (argc != 3)
+    {
+        printf(USAGE, argv[0]);
+        return 1;
+    }
+
+    const auto data = pkgi_load(argv[2]);
+    std::vector<std::string_view> paths;
+    for (auto ptr = reinterpret_cast<const char*>(data.data()),
+              end = ptr + data.size();
+         ptr < end;)
+    {
+        const auto line_end = std::find(ptr, end, '\n');
+        const auto line = std::string_view(ptr, line_end - ptr);
+        paths.push_back(line.substr(0, line.find('=')));
+        ptr = line_end + 1;
+    }
+
+    std::vector<std::string> regex_matches;
+    const auto regex_ms = time_ms(
+            [&]
+            {
+                const auto regex = std::regex(
+                        R"(([A-Z]{4}\d{5})-(\d{2}_\d{3})-(\d{2}_\d{2})-(\d{2}_\d{2}).ppk)");
+                for (const auto path_view : paths)
+                {
+                    const auto path = std::string(path_view);
+                    std::smatch matches;
+                    if (std::regex_search(path, matches, regex))
+                        regex_matches.push_back(
+                                matches.str(1) + matches.str(3));
+                }
+            });
+
+    std::vector<std::string> matches;
+    const auto matcher_ms = time_ms(
+            [&]
+            {
+                for (const auto path : paths)
+                    if (const auto name = pkgi_parse_comppack_name(path))
+                        matches.push_back(
+                                std::string(name->titleid) +
+                                std::string(name->app_version));
+            });
+
+    fmt::print(
+            "{} lineas, {} packs: regex {:.1f} ms, sin regex {:.1f} ms{}\n",
+            paths.size(),
+            matches.size(),
+            regex_ms,
+            matcher_ms,
+            matches == regex_matches ? "" : " (resultados distintos)");
+
+    return 0;
+}
+
+// looks up the title ids of a comp pack list, and as many that aren't in it,
+// one at a time and in a single batch
+int comppacklookupbench(int argc, char* argv[])
+{
+    if (argc != 3)
+    {
+        printf(USAGE, argv[0]);
+        return 1;
+    }
+
+    const auto http = std::make_unique<FileHttp>();
+    const auto db = std::make_unique<CompPackDatabase>("comppack_bench.db");
+    db->update(http.get(), argv[2]);
+
+    const auto data = pkgi_load(argv[2]);
+    std::vector<std::string> titleids;
+    for (auto ptr = reinterpret_cast<const char*>(data.data()),
+              end = ptr + data.size();
+         ptr < end;)
+    {
+        const auto line_end = std::find(ptr, end, '\n');
+        if (const auto name = pkgi_parse_comppack_name(std::string_view(
+                    ptr, line_end - ptr)))
+        {
+            titleids.emplace_back(name->titleid);
+            // same title id with another prefix
+            titleids.push_back("XXXX" + std::string(name->titleid.substr(4)));
+        }
+        ptr = line_end + 1;
+    }
+
+    size_t found = 0;
+    const auto single_ms = time_ms(
+            [&]
+            {
+                for (const auto& titleid : titleids)
+                    if (db->get(titleid))
+                        ++found;
+            });
+
+    std::vector<std::optional<CompPackDatabase::Item>> items;
+    const auto batch_ms = time_ms([&] { items = db->get(titleids); });
+    const auto batch_found = std::count_if(
+            items.begin(), items.end(), [](const auto& item) { return item; });
+
+    size_t index_found = 0;
+    bool same_items = true;
+    const auto index_ms = time_ms(
+            [&]
+            {
+                for (const auto& titleid : titleids)
+                    if (db->contains(titleid))
+                        ++index_found;
+            });
+    for (size_t i = 0; i < titleids.size(); ++i)
+    {
+        const auto item = db->find(titleids[i]);
+        same_items = same_items && item.has_value() == items[i].has_value() &&
+                     (!item || (item->path == items[i]->path &&
+                                item->app_version == items[i]->app_version));
+    }
+
+    // the index of a second instance is the only memory it allocates besides
+    // sqlite's
+    const auto heap = mallinfo2().uordblks;
+    const auto sqlite_heap = sqlite3_memory_used();
+    const auto other = std::make_unique<CompPackDatabase>("comppack_bench.db");
+    const auto sqlite_bytes = sqlite3_memory_used() - sqlite_heap;
+    const auto index_bytes = mallinfo2().uordblks - heap - sqlite_bytes;
+
+    fmt::print(
+            "{} busquedas, {} encontradas: {:.2f} us por busqueda, {:.2f} us "
+            "en lote, {:.3f} us en memoria{}\n",
+            titleids.size(),
+            found,
+            single_ms * 1000 / titleids.size(),
+            batch_ms * 1000 / titleids.size(),
+            index_ms * 1000 / titleids.size(),
+            (size_t)batch_found == found && index_found == found && same_items
+                    ? ""
+                    : " (resultados distintos)");
+    fmt::print(
+            "indice: {} juegos, {:.2f} MB, y {:.2f} MB de la conexion\n",
+            other->index_size(),
+            index_bytes / 1e6,
+            sqlite_bytes / 1e6);
+
+    return 0;
+}
+
+// loads each comp pack list into an existing db, which it replaces
+int comppackloadbench(int argc, char* argv[])
+{
+    if (argc < 3)
+    {
+        printf(USAGE, argv[0]);
+        return 1;
+    }
+
+    const auto db = std::make_unique<CompPackDatabase>("comppack_bench.db");
+    for (int i = 2; i < argc; ++i)
+    {
+        const auto http = std::make_unique<FileHttp>();
+        const auto ms = time_ms([&] { db->update(http.get(), argv[i]); });
+        fmt::print("{}: {:.1f} ms\n", argv[i], ms);
+    }
+
+    return 0;
+}
+
+// bytes written by the process so far
+uint64_t written_bytes()
+{
+    std::ifstream io("/proc/self/io");
+    std::string key;
+    uint64_t value;
+    while (io >> key >> value)
+        if (key == "wchar:")
+            return value;
+    return 0;
+}
+
+// installs a comp pack into tmp/file by saving it first, like pkgj does when
+// the zip can't be streamed, and into tmp/stream as it is read
+int comppackinstallbench(int argc, char* argv[])
+{
+    if (argc != 3)
+    {
+        printf(USAGE, argv[0]);
+        return 1;
+    }
+
+    pkgi_mkdirs("tmp/pkgj");
+    pkgi_mkdirs("tmp/file");
+    pkgi_mkdirs("tmp/stream");
+
+    auto written = written_bytes();
+    const auto file_ms = time_ms(
+            [&]
+            {
+                FileDownload download(std::make_unique<FileHttp>());
+                download.update_progress_cb = [](uint64_t, uint64_t) {};
+                download.is_canceled = [] { return false; };
+                download.download("tmp/", "bench", argv[2]);
+                pkgi_extract_zip("tmp/pkgj/bench-comp.ppk", "tmp/file");
+                pkgi_rm("tmp/pkgj/bench-comp.ppk");
+            });
+    const auto file_written = written_bytes() - written;
+
+    written = written_bytes();
+    const auto stream_ms = time_ms(
+            [&]
+            {
+                pkgi_extract_zip_stream(
+                        [] { return std::make_unique<FileHttp>(); },
+                        argv[2],
+                        "tmp/stream");
+            });
+    const auto stream_written = written_bytes() - written;
+
+    fmt::print(
+            "archivo temporal: {:.1f} MB escritos en {:.0f} ms, en flujo: "
+            "{:.1f} MB escritos en {:.0f} ms\n",
+            file_written / 1e6,
+            file_ms,
+            stream_written / 1e6,
+            stream_ms);
+
+    return 0;
+}
+
+// decodes every zRIF of a list, as done after it is refreshed
+int zrifbench(int argc, char* argv[])
+{
+    if (argc != 4 && argc != 5)
+    {
+        printf(USAGE, argv[0]);
+        return 1;
+    }
+
+    const auto db = load_bench_list(argv[2], argv[3]);
+    const unsigned workers = argc == 5 ? std::stoul(argv[4]) : 3;
+
+    Catalog catalog;
+    size_t flagged = 0;
+    size_t zrif_bytes = 0;
+    for (unsigned int i = 0; i < db->count(); ++i)
+    {
+        const auto item = db->get(i);
+        catalog.add(*item, 0);
+        flagged += (item->flags & DbItemBadZrif) != 0;
+        zrif_bytes += item->zrif.size();
+    }
+
+    for (const auto worker_count : {1u, workers})
+    {
+        std::vector<std::string> bad;
+        const auto ms = time_ms(
+                [&] { bad = pkgi_find_bad_zrifs(catalog, worker_count); });
+        fmt::print(
+                "{} hilos: {} zRIF en {:.1f} ms, {:.0f} zRIF/s, {:.1f} MB/s, "
+                "{} corruptos\n",
+                worker_count,
+                catalog.size(),
+                ms,
+                catalog.size() / ms * 1000,
+                zrif_bytes / ms / 1000,
+                bad.size());
+    }
+    fmt::print("marcados en la lista: {}\n", flagged);
+
+    return 0;
+}
+
+// Fails its connection after a number of bytes, alternating between an
+// error and a connection closed early
+class FaultyHttp : public FileHttp
+{
+public:
+    FaultyHttp(uint64_t fail_after, bool error)
+        : _left(fail_after), _error(error)
+    {
+    }
+
+    int64_t read(uint8_t* buffer, uint64_t size) override
+    {
+        if (_left == 0)
+        {
+            if (_error)
+                throw HttpError("conexion interrumpida");
+            return 0;
+        }
+        const auto read = FileHttp::read(buffer, std::min(size, _left));
+        _left -= read;
+        return read;
+    }
+
+private:
+    uint64_t _left;
+    bool _error;
+};
+
+int resumedownload(int argc, char* argv[])
+{
+    if (argc != 4)
+    {
+        printf(USAGE, argv[0]);
+        return 1;
+    }
+
+    pkgi_mkdirs("tmp/pkgj");
+    pkgi_rm("tmp/pkgj/resume-comp.ppk.resume");
+
+    const uint64_t fail_after = std::stoull(argv[3]);
+    for (int attempt = 1;; ++attempt)
+    {
+        FileDownload download(
+                std::make_unique<FaultyHttp>(fail_after, attempt % 2));
+        try
+        {
+            download.download("tmp/", "resume", argv[2]);
+            fmt::print(
+                    "intento {} desde {}: completado\n",
+                    attempt,
+                    download.resumed_offset());
+            break;
+        }
+        catch (const std::exception& e)
+        {
+            fmt::print(
+                    "intento {} desde {}: {}\n",
+                    attempt,
+                    download.resumed_offset(),
+                    e.what());
+        }
+    }
+
+    const auto expected = pkgi_load(argv[2]);
+    const auto result = pkgi_load("tmp/pkgj/resume-comp.ppk");
+    fmt::print(
+            "{}, {} bytes\n",
+            result == expected ? "identico" : "DIFERENTE",
+            result.size());
+    return result == expected ? 0 : 1;
+}
+
+// extracts a zip as it downloads through connections that fail after a number
+// of bytes, into tmp/resumestream
+int resumestream(int argc, char* argv[])
+{
+    if (argc != 4)
+    {
+        printf(USAGE, argv[0]);
+        return 1;
+    }
+
+    pkgi_mkdirs("tmp/resumestream");
+
+    const uint64_t fail_after = std::stoull(argv[3]);
+    unsigned connections = 0;
+    pkgi_extract_zip_stream(
+            [&]
+            {
+                ++connections;
+                return std::make_unique<FaultyHttp>(
+                        fail_after, connections % 2);
+            },
+            argv[2],
+            "tmp/resumestream");
+    fmt::print("extraido con {} conexiones\n", connections);
+
+    return 0;
+}
+
+// stand-in for the patch info server, serves the XMLs from a directory laid
+// out like the server, {titleid}/{hmac}/{titleid}-ver.xml
+class PatchServerHttp : public SlowHttp
+{
+public:
+    static constexpr auto SERVER =
+            "https://gs-sec.ww.np.dl.playstation.net/pl/np/";
+
+    PatchServerHttp(
+            const std::string& dir,
+            std::atomic<unsigned>& requests,
+            std::atomic<unsigned>& not_modified)
+        : SlowHttp(0)
+        , _dir(dir)
+        , _requests(requests)
+        , _not_modified(not_modified)
+    {
+    }
+
+    void start(const std::string& url, uint64_t offset) override
+    {
+        const std::string server = SERVER;
+        if (url.compare(0, server.size(), server) != 0)
+            throw HttpError("host desconocido: " + url);
+        const auto path = fmt::format("{}/{}", _dir, url.substr(server.size()));
+
+        ++_requests;
+        _missing = !pkgi_file_exists(path);
+        SlowHttp::start(path, offset);
+        if (get_status() == 304)
+            ++_not_modified;
+    }
+
+    int get_status() override
+    {
+        return _missing ? 404 : SlowHttp::get_status();
+    }
+
+private:
+    std::string _dir;
+    std::atomic<unsigned>& _requests;
+    std::atomic<unsigned>& _not_modified;
+    bool _missing = false;
+};
+
+// checks the titles of a file of "titleid version" lines against a
+// PatchServerHttp, the XMLs are cached in tmp/patchinfo
+int updatecheck(int argc, char* argv[])
+{
+    if (argc < 4 || argc > 6)
+    {
+        printf(USAGE, argv[0]);
+        return 1;
+    }
+
+    const std::string dir = argv[2];
+    const unsigned workers = argc > 4 ? std::stoul(argv[4]) : 4;
+    const int64_t ttl = argc > 5 ? std::stoll(argv[5])
+                                 : PatchInfoCache::DEFAULT_TTL;
+
+    std::vector<std::string> titleids;
+    std::unordered_map<std::string, std::string> versions;
+    std::ifstream titles(argv[3]);
+    std::string titleid, version;
+    while (titles >> titleid >> version)
+    {
+        titleids.push_back(titleid);
+        versions[titleid] = version;
+    }
+
+    std::atomic<unsigned> requests{0};
+    std::atomic<unsigned> not_modified{0};
+    PatchInfoCache cache("tmp/patchinfo", ttl);
+    UpdateCheck check;
+    const auto ms = time_ms(
+            [&]
+            {
+                check = pkgi_check_updates(
+                        [&]
+                        {
+                            return std::make_unique<PatchServerHttp>(
+                                    dir, requests, not_modified);
+                        },
+                        cache,
+                        titleids,
+                        [&](const std::string& titleid)
+                        { return versions.at(titleid); },
+                        workers);
+            });
+
+    for (const auto& update : check.updates)
+        fmt::print(
+                "{}: {} -> {} (fw {})\n",
+                update.titleid,
+                update.installed_version,
+                update.patch.version,
+                update.patch.fw_version);
+    for (const auto& error : check.errors)
+        fmt::print("error {}\n", error);
+    fmt::print(
+            "{} juegos en {:.0f} ms con {} hilos: {} peticiones, {} sin "
+            "cambios, {} actualizaciones, {} errores\n",
+            titleids.size(),
+            ms,
+            workers,
+            requests.load(),
+            not_modified.load(),
+            check.updates.size(),
+            check.errors.size());
+
+    return 0;
+}
+
 int main(int argc, char* argv[])
 {
     if (argc < 2)
@@ -163,6 +1169,34 @@ int main(int argc, char* argv[])
         return extractzip(argc, argv);
     if (std::string(argv[1]) == "patchinfo")
         return patchinfo(argc, argv);
+    if (std::string(argv[1]) == "sortbench")
+        return sortbench(argc, argv);
+    if (std::string(argv[1]) == "lookupbench")
+        return lookupbench(argc, argv);
+    if (std::string(argv[1]) == "parsebench")
+        return parsebench(argc, argv);
+    if (std::string(argv[1]) == "searchbench")
+        return searchbench(argc, argv);
+    if (std::string(argv[1]) == "presence")
+        return presence(argc, argv);
+    if (std::string(argv[1]) == "queuebench")
+        return queuebench(argc, argv);
+    if (std::string(argv[1]) == "comppackbench")
+        return comppackbench(argc, argv);
+    if (std::string(argv[1]) == "comppacklookupbench")
+        return comppacklookupbench(argc, argv);
+    if (std::string(argv[1]) == "comppackloadbench")
+        return comppackloadbench(argc, argv);
+    if (std::string(argv[1]) == "comppackinstallbench")
+        return comppackinstallbench(argc, argv);
+    if (std::string(argv[1]) == "resumedownload")
+        return resumedownload(argc, argv);
+    if (std::string(argv[1]) == "resumestream")
+        return resumestream(argc, argv);
+    if (std::string(argv[1]) == "zrifbench")
+        return zrifbench(argc, argv);
+    if (std::string(argv[1]) == "updatecheck")
+        return updatecheck(argc, argv);
 
     printf(USAGE, argv[0]);
     return 1;
@@ -1,5 +1,6 @@
 #include "comppackdb.hpp"
 
+#include "gzip.hpp"
 #include "pkgi.hpp"
 #include "sqlite.hpp"
 #include "utils.hpp"
@@ -10,24 +11,36 @@
 
 #include <algorithm>
 #include <cstring>
-#include <regex>
 #include <stdexcept>
 #include <string>
 
 #include <stddef.h>
 
-CompPackDatabase::CompPackDatabase(std::string const& dbPath) : _dbPath(dbPath)
+CompPackDatabase::CompPackDatabase(std::string const& dbPath)
+    : _dbPath(dbPath), _index_mutex("comppack_index_mutex")
 {
     reopen();
+    load_index();
 }
 
 void CompPackDatabase::reopen()
 {
     LOG("abriendo base de datos %s", _dbPath.c_str());
+    _get_stmt.reset();
+    _check_stmt.reset();
+
     sqlite3* db;
     SQLITE_CHECK(sqlite3_open(_dbPath.c_str(), &db), "imposible abrir base de datos");
     _sqliteDb.reset(db);
 
+    // the db only caches the downloaded list, an update interrupted by a
+    // power failure is refreshed again, so one sync per commit is enough and
+    // truncating the journal is cheaper than deleting it on the memory card
+    SQLITE_EXEC(
+            _sqliteDb,
+            "PRAGMA journal_mode = TRUNCATE; PRAGMA synchronous = NORMAL",
+            "Imposible configurar base de datos");
+
     try
     {
         sqlite3_stmt* stmt;
@@ -63,187 +76,452 @@ void CompPackDatabase::reopen()
             PRIMARY KEY (titleid, app_version)
         ))",
             "Imposible crear tabla pack comp");
+
+    _check_stmt = prepare("SELECT 1 FROM entries LIMIT 1");
+    _get_stmt = prepare(
+            "SELECT path, app_version "
+            "FROM entries "
+            "WHERE titleid = ? ");
+}
+
+// After the app is suspended, all further queries on the connection return a
+// disk I/O error. Stepping a trivial query, which has to read the file, finds
+// that out so that the db is only reopened when it is needed.
+void CompPackDatabase::check_connection()
+{
+    sqlite3_reset(_check_stmt.get());
+    const auto err = sqlite3_step(_check_stmt.get());
+    sqlite3_reset(_check_stmt.get());
+    if ((err & 0xff) != SQLITE_IOERR)
+        return;
+
+    LOG("error de E/S en base de datos pack comp, reabriendo");
+    reopen();
+}
+
+SqliteStmtPtr CompPackDatabase::prepare(const char* sql)
+{
+    sqlite3_stmt* stmt;
+    SQLITE_CHECK(
+            sqlite3_prepare_v2(_sqliteDb.get(), sql, -1, &stmt, nullptr),
+            "imposible preparar estamento SQL");
+    return SqliteStmtPtr(stmt);
 }
 
 namespace
 {
-std::vector<const char*> pkgi_split_row(char** pptr, const char* end)
+bool is_upper(char c)
 {
-    auto& ptr = *pptr;
+    return c >= 'A' && c <= 'Z';
+}
+
+bool is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
 
-    std::vector<const char*> result;
-    while (ptr != end)
+// matches name against pattern, where A is an uppercase letter, 9 a digit
+// and ? any character
+bool match_pattern(const char* name, std::string_view pattern)
+{
+    for (size_t i = 0; i < pattern.size(); ++i)
     {
-        const char* field = ptr;
-        while (ptr != end && *ptr != '=' && *ptr != '\n')
-            ++ptr;
-        if (ptr == end)
+        const char c = name[i];
+        switch (pattern[i])
         {
-            result.push_back(field);
+        case 'A':
+            if (!is_upper(c))
+                return false;
             break;
-        }
-        if (*ptr == '\n')
-        {
-            *ptr++ = 0;
+        case '9':
+            if (!is_digit(c))
+                return false;
             break;
-        }
-        *ptr++ = 0;
-        result.push_back(field);
-
-        if (ptr == end)
-        {
-            result.push_back(field);
+        case '?':
             break;
+        default:
+            if (c != pattern[i])
+                return false;
         }
     }
-    return result;
+    return true;
 }
+
+// TITLEID-XX_XXX-XX_XX-XX_XX.ppk, the dot can be any character
+constexpr std::string_view COMPPACK_NAME = "AAAA99999-99_999-99_99-99_99?ppk";
+constexpr size_t COMPPACK_VERSION_OFFSET = 17;
+constexpr size_t COMPPACK_VERSION_SIZE = 5;
 }
 
-void CompPackDatabase::parse_entries(std::string& db_data)
+std::optional<CompPackName> pkgi_parse_comppack_name(std::string_view path)
 {
-    SQLITE_EXEC(_sqliteDb, "BEGIN", "Imposible usar begin");
+    if (path.size() < COMPPACK_NAME.size())
+        return std::nullopt;
 
-    BOOST_SCOPE_EXIT_ALL(&)
+    const auto last = path.size() - COMPPACK_NAME.size();
+    for (size_t start = 0; start <= last; ++start)
     {
-        if (std::uncaught_exceptions() == 0)
-            SQLITE_EXEC(_sqliteDb, "END", "Imposible finalizar");
-        else
+        // cheap rejection before the full match
+        if (path[start + 9] != '-' ||
+            !match_pattern(path.data() + start, COMPPACK_NAME))
+            continue;
+        return CompPackName{
+                path.substr(start, 9),
+                path.substr(
+                        start + COMPPACK_VERSION_OFFSET,
+                        COMPPACK_VERSION_SIZE)};
+    }
+    return std::nullopt;
+}
+
+namespace
+{
+// rows inserted by each statement, their 3 parameters each stay under the 999
+// parameters sqlite allows by default
+constexpr size_t INSERT_ROWS = 64;
+
+std::string insert_statement(size_t rows)
+{
+    std::string sql =
+            "INSERT INTO entries_new (titleid, path, app_version) VALUES ";
+    for (size_t i = 0; i < rows; ++i)
+        sql += i == 0 ? "(?, ?, ?)" : ", (?, ?, ?)";
+    return sql;
+}
+
+// Parses a comp pack list given in chunks of any size and inserts its lines
+// into entries_new as soon as INSERT_ROWS of them are complete. Memory use
+// doesn't depend on the size of the list.
+class CompPackLoader
+{
+public:
+    CompPackLoader(
+            sqlite3* db, SqliteStmtPtr batch_stmt, SqliteStmtPtr row_stmt)
+        : _db(db)
+        , _batch_stmt(std::move(batch_stmt))
+        , _row_stmt(std::move(row_stmt))
+    {
+    }
+
+    void feed(const char* data, size_t size)
+    {
+        const char* const end = data + size;
+        const char* ptr = data;
+
+        if (!_partial.empty())
         {
-            char* errmsg;
-            auto err = sqlite3_exec(
-                    _sqliteDb.get(), "ROLLBACK", nullptr, nullptr, &errmsg);
-            if (err != SQLITE_OK)
-                LOG("error sqlite: %s", errmsg);
+            const char* const nl =
+                    static_cast<const char*>(memchr(ptr, '\n', end - ptr));
+            _partial.append(ptr, nl ? nl : end);
+            if (!nl)
+                return;
+            parse_line(_partial);
+            _partial.clear();
+            ptr = nl + 1;
         }
-    };
 
-    SQLITE_EXEC(_sqliteDb, "DELETE FROM entries", "imposible truncar tabla");
+        while (const char* const nl =
+                       static_cast<const char*>(memchr(ptr, '\n', end - ptr)))
+        {
+            parse_line(std::string_view(ptr, nl - ptr));
+            ptr = nl + 1;
+        }
 
-    sqlite3_stmt* stmt;
-    SQLITE_CHECK(
-            sqlite3_prepare_v2(
-                    _sqliteDb.get(),
-                    R"(INSERT INTO entries
-                    (titleid, path, app_version)
-                    VALUES (?, ?, ?))",
-                    -1,
-                    &stmt,
-                    nullptr),
-            "imposible preparar estamento SQL");
-    BOOST_SCOPE_EXIT_ALL(&)
+        // keep the beginning of the line for the next chunk
+        _partial.assign(ptr, end);
+    }
+
+    void finish()
     {
-        sqlite3_finalize(stmt);
-    };
+        if (!_partial.empty())
+            parse_line(_partial);
+        _partial.clear();
 
-    char* ptr = db_data.data();
-    char* end = db_data.data() + db_data.size();
+        for (size_t row = 0; row < _row_count; ++row)
+            insert(_row_stmt.get(), row, 1);
+        _row_count = 0;
+    }
 
-    const auto regex = std::regex(
-            R"(([A-Z]{4}\d{5})-(\d{2}_\d{3})-(\d{2}_\d{2})-(\d{2}_\d{2}).ppk)");
+    size_t lines() const
+    {
+        return _lines;
+    }
 
-    const char* current_line = ptr;
-    while (ptr < end && *ptr)
+private:
+    sqlite3* const _db;
+    const SqliteStmtPtr _batch_stmt;
+    const SqliteStmtPtr _row_stmt;
+    std::string _partial;
+    // titleid, path and app version of the rows not inserted yet, the
+    // strings keep their capacity from one batch to the next
+    std::array<std::array<std::string, 3>, INSERT_ROWS> _rows;
+    size_t _row_count = 0;
+    size_t _lines = 0;
+
+    void parse_line(std::string_view line)
     {
-        try
-        {
-            current_line = ptr;
-            const auto fields = pkgi_split_row(&ptr, end);
-            if (fields.size() < 1)
-                throw std::runtime_error("imposible dividir linea");
-
-            const auto path = std::string(fields[0]);
-
-            std::smatch matches;
-            if (!std::regex_search(path, matches, regex))
-                throw formatEx<std::runtime_error>("regex no coincide");
-            const auto titleid = matches.str(1);
-            const auto app_version = matches.str(3);
-
-            sqlite3_reset(stmt);
-            sqlite3_bind_text(stmt, 1, titleid.data(), titleid.size(), nullptr);
-            sqlite3_bind_text(stmt, 2, path.data(), path.size(), nullptr);
-            sqlite3_bind_text(
-                    stmt, 3, app_version.data(), app_version.size(), nullptr);
-
-            auto err = sqlite3_step(stmt);
-            if (err != SQLITE_DONE)
-                throw std::runtime_error(fmt::format(
-                        "imposible ejecutar estamento SQL:\n{}",
-                        sqlite3_errmsg(_sqliteDb.get())));
-        }
-        catch (const std::exception& e)
-        {
+        ++_lines;
+
+        // lines are path=name
+        const auto path = line.substr(0, line.find('='));
+
+        const auto name = pkgi_parse_comppack_name(path);
+        if (!name)
             throw formatEx<std::runtime_error>(
-                    "fallo al parsear linea\n{}\n{}", current_line, e.what());
+                    "fallo al parsear linea\n{}\nnombre de pack comp no "
+                    "reconocido",
+                    line);
+
+        auto& row = _rows[_row_count];
+        row[0].assign(name->titleid);
+        row[1].assign(path);
+        row[2].assign(name->app_version);
+
+        if (++_row_count == INSERT_ROWS)
+        {
+            insert(_batch_stmt.get(), 0, INSERT_ROWS);
+            _row_count = 0;
         }
     }
+
+    void insert(sqlite3_stmt* stmt, size_t first, size_t count)
+    {
+        for (size_t row = 0; row < count; ++row)
+            for (size_t column = 0; column < 3; ++column)
+            {
+                const auto& value = _rows[first + row][column];
+                sqlite3_bind_text(
+                        stmt,
+                        row * 3 + column + 1,
+                        value.data(),
+                        value.size(),
+                        nullptr);
+            }
+
+        auto err = sqlite3_step(stmt);
+        sqlite3_reset(stmt);
+        if (err != SQLITE_DONE)
+            throw std::runtime_error(fmt::format(
+                    "imposible ejecutar estamento SQL:\n{}",
+                    sqlite3_errmsg(_db)));
+    }
+};
 }
 
-void CompPackDatabase::update(Http* http, const std::string& update_url)
+// The list is parsed while it is downloaded and loaded into a new table
+// without an index, the index is built once all rows are in, and the new
+// table replaces the old one in the same transaction. Lookups never see a
+// partially loaded list.
+void CompPackDatabase::update(
+        Http* http,
+        const std::string& update_url,
+        const std::function<void(uint64_t, uint64_t)>& progress)
 {
-    std::string db_data;
-    db_data.resize(MAX_DB_SIZE);
-    uint64_t db_size = 0;
-
     if (update_url.empty())
         throw std::runtime_error("no hay url de pack comp");
 
     LOGF("cargando lista pack comp desde {}", update_url);
 
+    http->add_request_header("Accept-Encoding", "gzip");
     http->start(update_url, 0);
 
     const auto length = http->get_length();
+    const bool encoded = pkgi_is_compressed_encoding(
+            http->get_response_header("Content-Encoding"));
 
-    if (length > (int64_t)db_data.size())
-        throw std::runtime_error(
-                "lista pack comp muy grande... mira una nueva version de pkgj");
+    check_connection();
+
+    // big enough for the index to be sorted without spilling to the card
+    SQLITE_EXEC(
+            _sqliteDb,
+            "PRAGMA cache_size = -8192",
+            "Imposible cambiar tamano de cache");
+    BOOST_SCOPE_EXIT_ALL(&)
+    {
+        sqlite3_exec(
+                _sqliteDb.get(),
+                "PRAGMA cache_size = -2000",
+                nullptr,
+                nullptr,
+                nullptr);
+    };
+
+    SQLITE_EXEC(_sqliteDb, "BEGIN", "Imposible usar begin");
+
+    BOOST_SCOPE_EXIT_ALL(&)
+    {
+        if (std::uncaught_exceptions() == 0)
+            SQLITE_EXEC(_sqliteDb, "END", "Imposible finalizar");
+        else
+        {
+            char* errmsg;
+            auto err = sqlite3_exec(
+                    _sqliteDb.get(), "ROLLBACK", nullptr, nullptr, &errmsg);
+            if (err != SQLITE_OK)
+                LOG("error sqlite: %s", errmsg);
+        }
+    };
+
+    SQLITE_EXEC(
+            _sqliteDb,
+            R"(
+        DROP TABLE IF EXISTS entries_new;
+        CREATE TABLE entries_new (
+            titleid TEXT NOT NULL,
+            app_version TEXT NOT NULL,
+            path TEXT NOT NULL
+        ))",
+            "Imposible crear tabla pack comp");
+
+    CompPackLoader loader(
+            _sqliteDb.get(),
+            prepare(insert_statement(INSERT_ROWS).c_str()),
+            prepare(insert_statement(1).c_str()));
 
+    std::optional<Inflater> inflater;
+    const auto feed = [&](uint8_t* data, size_t size)
+    { loader.feed(reinterpret_cast<const char*>(data), size); };
+
+    std::vector<uint8_t> chunk(64 * 1024);
+    uint64_t db_size = 0;
     for (;;)
     {
-        uint32_t want = (uint32_t)min64(64 * 1024, db_data.size() - db_size);
-        int read = http->read(
-                reinterpret_cast<uint8_t*>(db_data.data()) + db_size, want);
-        if (read == 0)
+        const auto read = http->read(chunk.data(), chunk.size());
+        if (read <= 0)
             break;
+
+        if (db_size == 0 && (encoded || pkgi_is_gzip(chunk.data(), read)))
+            inflater.emplace();
         db_size += read;
+
+        if (inflater)
+            inflater->feed(chunk.data(), read, feed);
+        else
+            feed(chunk.data(), read);
+
+        if (progress)
+            progress(db_size, length);
     }
 
     if (db_size == 0)
         throw std::runtime_error(
                 "lista pack comp vacia... mira una nueva version de pkgj");
 
-    LOG("parseando objetos");
+    if (inflater)
+        inflater->finish();
+    loader.finish();
 
-    db_data.resize(db_size);
-    parse_entries(db_data);
+    SQLITE_EXEC(
+            _sqliteDb,
+            R"(
+        DROP TABLE IF EXISTS entries;
+        CREATE UNIQUE INDEX entries_titleid
+            ON entries_new (titleid, app_version);
+        ALTER TABLE entries_new RENAME TO entries)",
+            "Imposible reemplazar tabla pack comp");
+
+    LOGF("lista pack comp cargada: {} lineas", loader.lines());
+
+    // the new table is already visible to this connection
+    load_index();
+}
+
+void CompPackDatabase::load_index()
+{
+    const auto stmt = prepare(
+            "SELECT titleid, path, app_version "
+            "FROM entries "
+            "ORDER BY titleid, app_version");
+
+    std::unordered_map<std::string, Item> index;
+    int err;
+    while ((err = sqlite3_step(stmt.get())) == SQLITE_ROW)
+    {
+        const auto titleid = reinterpret_cast<const char*>(
+                sqlite3_column_text(stmt.get(), 0));
+        // the first row of each title id has the lowest version
+        if (index.find(titleid) != index.end())
+            continue;
+
+        std::string app_version = reinterpret_cast<const char*>(
+                sqlite3_column_text(stmt.get(), 2));
+        // replace _ by .
+        app_version[2] = '.';
+        index.emplace(
+                titleid,
+                Item{reinterpret_cast<const char*>(
+                             sqlite3_column_text(stmt.get(), 1)),
+                     std::move(app_version)});
+    }
+    if (err != SQLITE_DONE)
+        throw std::runtime_error(fmt::format(
+                "imposible ejecutar estamento SQL:\n{}",
+                sqlite3_errmsg(_sqliteDb.get())));
+
+    LOGF("indice pack comp: {} juegos", index.size());
+
+    // the old index is freed once the lock is released
+    ScopeLock lock(_index_mutex);
+    _index.swap(index);
+}
 
-    LOG("parseo finalizado");
+std::optional<CompPackDatabase::Item> CompPackDatabase::find(
+        std::string_view titleid) const
+{
+    ScopeLock lock(_index_mutex);
+    const auto it = _index.find(std::string(titleid));
+    if (it == _index.end())
+        return std::nullopt;
+    return it->second;
+}
+
+bool CompPackDatabase::contains(std::string_view titleid) const
+{
+    ScopeLock lock(_index_mutex);
+    return _index.find(std::string(titleid)) != _index.end();
+}
+
+size_t CompPackDatabase::index_size() const
+{
+    ScopeLock lock(_index_mutex);
+    return _index.size();
 }
 
 std::optional<CompPackDatabase::Item> CompPackDatabase::get(
         const std::string& titleid)
 {
-    // we need to reopen the db before every query because for some reason,
-    // after the app is suspended, all further query will return disk I/O error
-    reopen();
+    check_connection();
+    return lookup(titleid);
+}
 
-    LOG("recargando base de datos");
+std::vector<std::optional<CompPackDatabase::Item>> CompPackDatabase::get(
+        const std::vector<std::string>& titleids)
+{
+    check_connection();
 
-    sqlite3_stmt* stmt;
-    SQLITE_CHECK(
-            sqlite3_prepare_v2(
-                    _sqliteDb.get(),
-                    "SELECT path, app_version "
-                    "FROM entries "
-                    "WHERE titleid = ? ",
-                    -1,
-                    &stmt,
-                    nullptr),
-            "imposible preparar estamento SQL");
+    // without a transaction, each lookup locks the file and checks that the
+    // db didn't change
+    SQLITE_EXEC(_sqliteDb, "BEGIN", "Imposible usar begin");
     BOOST_SCOPE_EXIT_ALL(&)
     {
-        sqlite3_finalize(stmt);
+        sqlite3_exec(_sqliteDb.get(), "END", nullptr, nullptr, nullptr);
+    };
+
+    std::vector<std::optional<Item>> items;
+    items.reserve(titleids.size());
+    for (const auto& titleid : titleids)
+        items.push_back(lookup(titleid));
+    return items;
+}
+
+std::optional<CompPackDatabase::Item> CompPackDatabase::lookup(
+        const std::string& titleid)
+{
+    const auto stmt = _get_stmt.get();
+    // resetting ends the read transaction the statement holds
+    BOOST_SCOPE_EXIT_ALL(&)
+    {
+        sqlite3_reset(stmt);
     };
 
     sqlite3_bind_text(stmt, 1, titleid.data(), titleid.size(), nullptr);
@@ -2,15 +2,30 @@
 
 #include "http.hpp"
 #include "sqlite.hpp"
+#include "thread.hpp"
 
 #include <array>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
 #include <cstdint>
 
+struct CompPackName
+{
+    std::string_view titleid;
+    // version of the game the pack is for, as XX_XX
+    std::string_view app_version;
+};
+
+// finds a comp pack file name like PCSE00000-00_000-01_00-00_00.ppk in path
+std::optional<CompPackName> pkgi_parse_comppack_name(std::string_view path);
+
 class CompPackDatabase
 {
 public:
@@ -22,18 +37,41 @@ public:
 
     CompPackDatabase(const std::string& dbPath);
 
-    void update(Http* http, const std::string& update_url);
+    void update(
+            Http* http,
+            const std::string& update_url,
+            const std::function<void(uint64_t, uint64_t)>& progress = {});
 
     std::optional<Item> get(const std::string& titleid);
+    // same as calling get for each title id, but in a single read transaction
+    std::vector<std::optional<Item>> get(
+            const std::vector<std::string>& titleids);
+
+    // Same as get, from a copy of the list kept in memory which is loaded
+    // when the db is opened and after each update. They don't touch the
+    // memory card and can be called from any thread.
+    std::optional<Item> find(std::string_view titleid) const;
+    bool contains(std::string_view titleid) const;
+    size_t index_size() const;
 
 private:
-    static constexpr auto MAX_DB_SIZE = 4 * 1024 * 1024;
+    using ScopeLock = std::lock_guard<Mutex>;
 
     std::string _dbPath;
 
-    SqlitePtr _sqliteDb = nullptr;
+    mutable Mutex _index_mutex;
+    // title id to the pack with the lowest app version, which is the one get
+    // returns
+    std::unordered_map<std::string, Item> _index;
 
-    void parse_entries(std::string& db_data);
+    SqlitePtr _sqliteDb = nullptr;
+    // prepared once per connection, they must be destroyed before it
+    SqliteStmtPtr _check_stmt;
+    SqliteStmtPtr _get_stmt;
 
     void reopen();
+    void check_connection();
+    SqliteStmtPtr prepare(const char* sql);
+    std::optional<Item> lookup(const std::string& titleid);
+    void load_index();
 };
@@ -1,18 +1,31 @@
 #include "db.hpp"
 
+#include "catalog.hpp"
+#include "download.hpp"
 #include "file.hpp"
+#include "gzip.hpp"
 #include "pkgi.hpp"
 #include "sha256.hpp"
+#include "tsv.hpp"
 #include "utils.hpp"
+#include "zrif.hpp"
 
 #include <fmt/format.h>
 
 #include <boost/scope_exit.hpp>
 
+#include <cereal/archives/binary.hpp>
+#include <cereal/types/string.hpp>
+#include <cereal/types/vector.hpp>
+
 #include <algorithm>
-#include <cstring>
+#include <charconv>
+#include <fstream>
+#include <memory>
+#include <optional>
 #include <stdexcept>
 #include <string>
+#include <utility>
 
 #include <stddef.h>
 
@@ -36,10 +49,15 @@ std::string pkgi_mode_to_string(Mode mode)
     return "Modo desconocido";
 }
 
-TitleDatabase::TitleDatabase(const std::string& dbPath) : _dbPath(dbPath)
+TitleDatabase::TitleDatabase(const std::string& dbPath, size_t memory_budget)
+    : _dbPath(dbPath)
+    , _lists_mutex("lists_mutex")
+    , _memory_budget(memory_budget)
 {
 }
 
+TitleDatabase::~TitleDatabase() = default;
+
 static const char* pkgi_mode_to_file_name(Mode mode)
 {
     switch (mode)
@@ -67,213 +85,565 @@ static const char* pkgi_mode_to_file_name(Mode mode)
 
 namespace
 {
-std::vector<const char*> pkgi_split_row(char** pptr, const char* end)
+// Position of the columns in the list of a mode, -1 if the list doesn't have
+// the column.
+struct ColumnLayout
 {
-    auto& ptr = *pptr;
-
-    std::vector<const char*> result;
-    while (ptr != end && *ptr != '\n')
+    int8_t region;
+    int8_t name;
+    int8_t url;
+    int8_t zrif;
+    int8_t content;
+    int8_t last_modification;
+    int8_t name_org;
+    int8_t size;
+    int8_t digest;
+    int8_t fw_version;
+    int8_t app_version;
+
+    // number of columns a row must have
+    constexpr unsigned columns() const
     {
-        const char* field = ptr;
-        while (ptr != end && *ptr != '\t' && *ptr != '\r')
-            ++ptr;
-        if (ptr == end)
-        {
-            result.push_back(field);
-            break;
-        }
-        *ptr++ = 0;
-        result.push_back(field);
-
-        if (ptr == end)
-        {
-            result.push_back(field);
-            break;
-        }
+        int last = -1;
+        for (const auto column :
+             {region,
+              name,
+              url,
+              zrif,
+              content,
+              last_modification,
+              name_org,
+              size,
+              digest,
+              fw_version,
+              app_version})
+            last = column > last ? column : last;
+        return last + 1;
     }
-    while (ptr != end && *ptr++ != '\n')
-        ;
-    return result;
+};
+
+// indexed by Mode
+// clang-format off
+constexpr ColumnLayout COLUMN_LAYOUTS[ModeCount] = {
+    //             reg nam url zrf cnt dat org siz dig  fw app
+    /* Games */    {1,  2,  3,  4,  5,  6,  7,  8,  9, 10, -1},
+    /* Dlcs */     {1,  2,  3,  4,  5,  6, -1,  7,  8, -1, -1},
+    /* Demos */    {1,  2,  3,  4,  5,  6,  7,  8,  9, 10, -1},
+    /* Themes */   {1,  2,  3,  4,  5,  6, -1,  7,  8, -1, -1},
+    /* PsmGames */ {1,  2,  3,  4,  5,  6, -1,  7,  8, -1, -1},
+    /* PsxGames */ {1,  2,  3, -1,  4,  5,  6,  7,  8, -1, -1},
+    /* PspGames */ {1,  3,  4, -1,  5,  6, -1,  9, 10, -1, -1},
+    /* PspDlcs */  {1,  2,  3, -1,  4,  5, -1,  8,  9, -1, -1},
+};
+// clang-format on
+static_assert(ModePspDlcs == ModeCount - 1, "COLUMN_LAYOUTS is out of date");
+
+uint32_t region_to_filter(std::string_view region)
+{
+    if (region == "ASIA")
+        return DbFilterRegionASA;
+    if (region == "EU")
+        return DbFilterRegionEUR;
+    if (region == "JP")
+        return DbFilterRegionJPN;
+    if (region == "US")
+        return DbFilterRegionUSA;
+    return 0;
 }
 
-enum class Column
+// FNV-1a
+uint64_t hash_bytes(std::string_view data)
 {
-    Region,
-    Content,
-    Name,
-    NameOrg,
-    AppVersion,
-    Zrif,
-    Url,
-    Digest,
-    Size,
-    FwVersion,
-    LastModification,
-};
+    uint64_t hash = 0xcbf29ce484222325;
+    for (const auto c : data)
+        hash = (hash ^ static_cast<uint8_t>(c)) * 0x100000001b3;
+    return hash;
+}
+
+// hash of the content id and hash of the whole line of a row
+using RowHash = std::pair<uint64_t, uint64_t>;
 
-int pkgi_get_column_number(Mode mode, Column column)
+// Parses a title list given in chunks of any size, rows may be cut anywhere
+// between two chunks.
+class CatalogParser
 {
-#define MAP_COL(name, i) \
-    case Column::name:   \
-        return i
+public:
+    CatalogParser(Mode mode, Catalog& catalog)
+        : _catalog(catalog), _parse_fields(select_parser(mode))
+    {
+    }
 
-    switch (mode)
+    // if set, the hashes of each row added to the catalog are appended to
+    // row_hashes, in catalog order
+    void collect_hashes(std::vector<RowHash>* row_hashes)
     {
-    case ModeGames:
-        switch (column)
+        _row_hashes = row_hashes;
+    }
+
+    // size is the size of the whole list, if known
+    void reserve(int64_t size)
+    {
+        // only a subset of the fields of each row is kept, the size of the
+        // list is a good upper bound of the size of the arena
+        if (size > 0 && size < UINT32_MAX)
+            _catalog.reserve(0, size);
+    }
+
+    void feed(const char* data, size_t size)
+    {
+        const char* const end = data + size;
+        const char* ptr = data;
+
+        if (!_partial.empty())
         {
-            MAP_COL(Region, 1);
-            MAP_COL(Name, 2);
-            MAP_COL(Url, 3);
-            MAP_COL(Zrif, 4);
-            MAP_COL(Content, 5);
-            MAP_COL(LastModification, 6);
-            MAP_COL(NameOrg, 7);
-            MAP_COL(Size, 8);
-            MAP_COL(Digest, 9);
-            MAP_COL(FwVersion, 10);
-            MAP_COL(AppVersion, -1);
-        default:
-            throw std::runtime_error("columna invalida");
+            const char* const nl = std::find(ptr, end, '\n');
+            _partial.insert(_partial.end(), ptr, nl);
+            if (nl == end)
+                return;
+            parse_partial_row();
+            ptr = nl + 1;
         }
-    case ModeDlcs:
-        switch (column)
+
+        // rows are split while their end is searched, with a single scan of
+        // the chunk
+        const char* row = ptr;
+        _row.start(row);
+        for (;;)
         {
-            MAP_COL(Region, 1);
-            MAP_COL(Name, 2);
-            MAP_COL(Url, 3);
-            MAP_COL(Zrif, 4);
-            MAP_COL(Content, 5);
-            MAP_COL(LastModification, 6);
-            MAP_COL(Size, 7);
-            MAP_COL(Digest, 8);
-            MAP_COL(NameOrg, -1);
-            MAP_COL(FwVersion, -1);
-            MAP_COL(AppVersion, -1);
-        default:
-            throw std::runtime_error("columna invalida");
+            const char* const delimiter = pkgi_find_tsv_delimiter(ptr, end);
+            if (delimiter == end)
+                break;
+            ptr = delimiter + 1;
+            if (*delimiter == '\n')
+            {
+                _row.finish(delimiter);
+                parse_row(row, delimiter);
+                row = ptr;
+                _row.start(row);
+            }
+            else
+                _row.add(ptr);
         }
-    case ModeDemos:
-        switch (column)
+
+        // keep the beginning of the row for the next chunk
+        _partial.assign(row, end);
+    }
+
+    void finish()
+    {
+        if (!_partial.empty())
+            parse_partial_row();
+    }
+
+private:
+    using FieldParser = void (CatalogParser::*)(const char*, const char*);
+
+    Catalog& _catalog;
+    const FieldParser _parse_fields;
+    unsigned _line = 0;
+    std::vector<char> _partial;
+    TsvRow _row;
+    std::string _full_name;
+    std::vector<RowHash>* _row_hashes = nullptr;
+
+    static FieldParser select_parser(Mode mode)
+    {
+        switch (mode)
         {
-            MAP_COL(Region, 1);
-            MAP_COL(Name, 2);
-            MAP_COL(Url, 3);
-            MAP_COL(Zrif, 4);
-            MAP_COL(Content, 5);
-            MAP_COL(LastModification, 6);
-            MAP_COL(NameOrg, 7);
-            MAP_COL(Size, 8);
-            MAP_COL(Digest, 9);
-            MAP_COL(FwVersion, 10);
-            MAP_COL(AppVersion, -1);
-        default:
-            throw std::runtime_error("columna invalida");
+#define PARSER(mode) \
+    case Mode##mode: \
+        return &CatalogParser::parse_fields<Mode##mode>
+            PARSER(Games);
+            PARSER(Dlcs);
+            PARSER(Demos);
+            PARSER(Themes);
+            PARSER(PsmGames);
+            PARSER(PsxGames);
+            PARSER(PspGames);
+            PARSER(PspDlcs);
+#undef PARSER
         }
-    case ModeThemes:
-        switch (column)
+        throw formatEx<std::runtime_error>(
+                "Modo desconocido {}", static_cast<int>(mode));
+    }
+
+    void parse_partial_row()
+    {
+        const char* const begin = _partial.data();
+        const char* const end = begin + _partial.size();
+        pkgi_split_tsv_row(begin, end, _row);
+        parse_row(begin, end);
+        _partial.clear();
+    }
+
+    // the row must have been split into _row
+    void parse_row(const char* begin, const char* end)
+    {
+        // skip header
+        if (++_line == 1)
+            return;
+
+        try
         {
-            MAP_COL(Region, 1);
-            MAP_COL(Name, 2);
-            MAP_COL(Url, 3);
-            MAP_COL(Zrif, 4);
-            MAP_COL(Content, 5);
-            MAP_COL(LastModification, 6);
-            MAP_COL(Size, 7);
-            MAP_COL(Digest, 8);
-            MAP_COL(NameOrg, -1);
-            MAP_COL(FwVersion, -1);
-            MAP_COL(AppVersion, -1);
-        default:
-            throw std::runtime_error("columna invalida");
+            (this->*_parse_fields)(begin, end);
         }
-    case ModePsmGames:
-        switch (column)
+        catch (const std::exception& e)
         {
-            MAP_COL(Region, 1);
-            MAP_COL(Name, 2);
-            MAP_COL(Url, 3);
-            MAP_COL(Zrif, 4);
-            MAP_COL(Content, 5);
-            MAP_COL(LastModification, 6);
-            MAP_COL(Size, 7);
-            MAP_COL(Digest, 8);
-            MAP_COL(NameOrg, -1);
-            MAP_COL(FwVersion, -1);
-            MAP_COL(AppVersion, -1);
-        default:
-            throw std::runtime_error("columna invalida");
+            throw formatEx<std::runtime_error>(
+                    "fallo al parsear linea {}: {}", _line, e.what());
         }
-    case ModePsxGames:
-        switch (column)
+    }
+
+    template <int column>
+    std::string_view field() const
+    {
+        if constexpr (column < 0)
+            return {};
+        else
+            return _row[column];
+    }
+
+    // one instance per mode, so that the position of each column is known
+    // at compile time
+    template <Mode mode>
+    void parse_fields(const char* begin, const char* end)
+    {
+        constexpr auto layout = COLUMN_LAYOUTS[mode];
+        static_assert(layout.columns() <= TsvRow::MaxFields);
+
+        if (_row.size() < layout.columns())
+            throw formatEx<std::runtime_error>(
+                    "{} columnas en vez de {}", _row.size(), layout.columns());
+
+        // the other fields are only looked at if the row is kept
+        const auto url = field<layout.url>();
+        const auto zrif = field<layout.zrif>();
+        if (url.empty() || url == "MISSING" || url == "CART ONLY" ||
+            zrif == "MISSING")
+            return;
+
+        const auto content = field<layout.content>();
+        const auto titleid = content.size() >= 7 + 9 ? content.substr(7, 9)
+                                                      : std::string_view();
+        const auto region = field<layout.region>();
+        const auto name = field<layout.name>();
+        const auto name_org = field<layout.name_org>();
+        const auto digest = field<layout.digest>();
+        const auto size = field<layout.size>();
+        const auto fw_version = field<layout.fw_version>();
+        const auto last_modification = field<layout.last_modification>();
+        const auto app_version = field<layout.app_version>();
+
+        bool bdigest = true;
+        std::array<uint8_t, 32> digest_array{};
+        if (digest.size() >= 2 * SHA256_DIGEST_SIZE)
+            digest_array = pkgi_hexbytes(digest.data(), SHA256_DIGEST_SIZE);
+        else
+            bdigest = false;
+
+        int64_t item_size = 0;
+        const auto size_end = size.data() + size.size();
+        if (!size.empty() &&
+            std::from_chars(size.data(), size_end, item_size).ec != std::errc())
+            throw formatEx<std::runtime_error>("tamano invalido: {}", size);
+
+        _full_name = name;
+        if (!app_version.empty())
         {
-            MAP_COL(Region, 1);
-            MAP_COL(Name, 2);
-            MAP_COL(Url, 3);
-            MAP_COL(Content, 4);
-            MAP_COL(LastModification, 5);
-            MAP_COL(NameOrg, 6);
-            MAP_COL(Size, 7);
-            MAP_COL(Digest, 8);
-            MAP_COL(Zrif, -1);
-            MAP_COL(FwVersion, -1);
-            MAP_COL(AppVersion, -1);
-        default:
-            throw std::runtime_error("columna invalida");
+            _full_name += " (";
+            _full_name += app_version;
+            _full_name += ')';
         }
-    case ModePspGames:
-        switch (column)
+        if (!name.empty() && name.back() != ']' && fw_version > "3.60")
         {
-            MAP_COL(Region, 1);
-            MAP_COL(Name, 3);
-            MAP_COL(Url, 4);
-            MAP_COL(Content, 5);
-            MAP_COL(LastModification, 6);
-            MAP_COL(Size, 9);
-            MAP_COL(Digest, 10);
-            MAP_COL(FwVersion, -1);
-            MAP_COL(NameOrg, -1);
-            MAP_COL(Zrif, -1);
-            MAP_COL(AppVersion, -1);
-        default:
-            throw std::runtime_error("columna invalida");
+            _full_name += " [";
+            _full_name += fw_version;
+            _full_name += ']';
         }
-    case ModePspDlcs:
-        switch (column)
+
+        _catalog.add(
+                DbItem{
+                        PresenceUnknown,
+                        titleid,
+                        content,
+                        0,
+                        _full_name,
+                        name_org,
+                        zrif,
+                        url,
+                        bdigest ? digest_array.data() : nullptr,
+                        item_size,
+                        last_modification,
+                        app_version,
+                        fw_version,
+                },
+                region_to_filter(region));
+
+        if (_row_hashes)
+            _row_hashes->emplace_back(
+                    hash_bytes(content),
+                    hash_bytes(std::string_view(begin, end - begin)));
+    }
+};
+
+// What is known of the last downloaded version of a list, stored next to it.
+// The validators are sent back to the server so that it can answer that the
+// list has not changed, the hashes are used to find the rows that changed
+// when it has.
+struct ListState
+{
+    static constexpr uint8_t Version = 2;
+
+    std::string etag;
+    std::string last_modified;
+    int64_t size = 0;
+    std::vector<uint8_t> sha256;
+    // content ids of the rows added or changed by the last update
+    std::vector<std::string> new_contents;
+    std::vector<std::string> updated_contents;
+    // content ids of the rows whose zRIF can't be decoded
+    std::vector<std::string> bad_zrif_contents;
+    // RowHash of each row, sorted. Stored last as they are not needed to
+    // load the list.
+    std::vector<uint64_t> content_hashes;
+    std::vector<uint64_t> line_hashes;
+};
+
+std::string list_state_path(const std::string& list_path)
+{
+    return list_path + ".state";
+}
+
+std::optional<ListState> load_list_state(
+        const std::string& path, bool with_hashes)
+{
+    if (!pkgi_file_exists(path))
+        return std::nullopt;
+
+    try
+    {
+        std::ifstream ss(path, std::ios::binary);
+        cereal::BinaryInputArchive iarchive(ss);
+
+        uint8_t version;
+        iarchive(version);
+        if (version != ListState::Version)
+            throw std::runtime_error("version de estado de lista invalida");
+
+        ListState state;
+        iarchive(state.etag, state.last_modified, state.size, state.sha256);
+        iarchive(state.new_contents, state.updated_contents);
+        iarchive(state.bad_zrif_contents);
+        if (with_hashes)
+            iarchive(state.content_hashes, state.line_hashes);
+        return state;
+    }
+    catch (const std::exception& e)
+    {
+        LOGF("fallo al leer {}: {}", path, e.what());
+        return std::nullopt;
+    }
+}
+
+void save_list_state(const std::string& path, const ListState& state)
+{
+    std::ofstream ss(path, std::ios::binary | std::ios::out | std::ios::trunc);
+    cereal::BinaryOutputArchive oarchive(ss);
+
+    oarchive(ListState::Version);
+    oarchive(state.etag, state.last_modified, state.size, state.sha256);
+    oarchive(state.new_contents, state.updated_contents);
+    oarchive(state.bad_zrif_contents);
+    oarchive(state.content_hashes, state.line_hashes);
+    if (!ss)
+        throw formatEx<std::runtime_error>("fallo al escribir {}", path);
+}
+
+// compares the rows of the new version of a list with the previous one
+void diff_rows(
+        const Catalog& catalog,
+        std::vector<RowHash>& row_hashes,
+        const ListState* previous,
+        ListState& state)
+{
+    if (previous)
+    {
+        for (uint32_t row = 0; row < row_hashes.size(); ++row)
         {
-            MAP_COL(Region, 1);
-            MAP_COL(Name, 2);
-            MAP_COL(Url, 3);
-            MAP_COL(Content, 4);
-            MAP_COL(LastModification, 5);
-            MAP_COL(Size, 8);
-            MAP_COL(Digest, 9);
-            MAP_COL(FwVersion, -1);
-            MAP_COL(NameOrg, -1);
-            MAP_COL(Zrif, -1);
-            MAP_COL(AppVersion, -1);
-        default:
-            throw std::runtime_error("columna invalida");
+            const auto& hashes = previous->content_hashes;
+            const auto it = std::lower_bound(
+                    hashes.begin(), hashes.end(), row_hashes[row].first);
+            if (it == hashes.end() || *it != row_hashes[row].first)
+                state.new_contents.emplace_back(catalog.content(row));
+            else if (
+                    previous->line_hashes[it - hashes.begin()] !=
+                    row_hashes[row].second)
+                state.updated_contents.emplace_back(catalog.content(row));
         }
-    default:
-        throw std::runtime_error("modo invalido");
     }
-#undef MAP_COL
+
+    std::sort(row_hashes.begin(), row_hashes.end());
+    state.content_hashes.clear();
+    state.line_hashes.clear();
+    state.content_hashes.reserve(row_hashes.size());
+    state.line_hashes.reserve(row_hashes.size());
+    for (const auto& hashes : row_hashes)
+    {
+        state.content_hashes.push_back(hashes.first);
+        state.line_hashes.push_back(hashes.second);
+    }
 }
 
-const char* get_or_empty(
-        Mode mode, std::vector<const char*> const& v, Column column)
+void apply_flags(Catalog& catalog, const ListState& state)
 {
-    const auto pos = pkgi_get_column_number(mode, column);
-    if (pos < 0)
-        return "";
-    return v.at(pos);
+    for (const auto& content : state.new_contents)
+        if (const auto row = catalog.find_content(content))
+            catalog.add_flags(*row, DbItemNew);
+    for (const auto& content : state.updated_contents)
+        if (const auto row = catalog.find_content(content))
+            catalog.add_flags(*row, DbItemUpdated);
+    for (const auto& content : state.bad_zrif_contents)
+        if (const auto row = catalog.find_content(content))
+            catalog.add_flags(*row, DbItemBadZrif);
 }
+
+void parse_file(const std::string& path, CatalogParser& parser)
+{
+    const auto file = pkgi_openrw(path.c_str());
+    if (!file)
+        throw formatEx<std::runtime_error>("fallo al abrir {}", path);
+    BOOST_SCOPE_EXIT_ALL(&)
+    {
+        pkgi_close(file);
+    };
+
+    // lists are stored compressed, older versions of pkgj stored them plain
+    std::optional<Inflater> inflater;
+    const auto feed = [&](uint8_t* data, size_t size) {
+        parser.feed(reinterpret_cast<const char*>(data), size);
+    };
+
+    std::vector<uint8_t> chunk(64 * 1024);
+    for (bool first = true;; first = false)
+    {
+        const auto read = pkgi_read(file, chunk.data(), chunk.size());
+        if (read <= 0)
+            break;
+
+        if (first && pkgi_is_gzip(chunk.data(), read))
+            inflater.emplace();
+        else if (first)
+            parser.reserve(pkgi_get_size(path.c_str()));
+
+        if (inflater)
+            inflater->feed(chunk.data(), read, feed);
+        else
+            feed(chunk.data(), read);
+    }
+    if (inflater)
+        inflater->finish();
+    parser.finish();
+}
+
+// shrinks the catalog and builds its indexes once it is complete
+void finish_catalog(Catalog& catalog)
+{
+    catalog.shrink_to_fit();
+    catalog.build_search_index();
+    catalog.build_lookup_index();
+
+    LOGF("lista cargada: {} objetos, {} bytes",
+         catalog.size(),
+         catalog.memory_usage());
+}
+}
+
+void pkgi_parse_catalog(
+        Mode mode, const char* data, size_t size, Catalog& catalog)
+{
+    CatalogParser parser(mode, catalog);
+    parser.reserve(size);
+    parser.feed(data, size);
+    parser.finish();
+}
+
+std::vector<std::string> pkgi_find_bad_zrifs(
+        const Catalog& catalog, unsigned worker_count)
+{
+    // each worker decodes a contiguous range of rows
+    std::vector<std::vector<uint32_t>> bad_rows(worker_count);
+    const auto check = [&](unsigned worker)
+    {
+        const uint32_t begin = uint64_t(catalog.size()) * worker / worker_count;
+        const uint32_t end =
+                uint64_t(catalog.size()) * (worker + 1) / worker_count;
+
+        uint8_t rif[PKGI_PSM_RIF_SIZE];
+        char message[256];
+        for (uint32_t row = begin; row < end; ++row)
+        {
+            const auto zrif = catalog.zrif(row);
+            // the strings of the catalog are null-terminated
+            if (!zrif.empty() &&
+                !pkgi_zrif_decode(zrif.data(), rif, message, sizeof(message)))
+                bad_rows[worker].push_back(row);
+        }
+    };
+
+    {
+        std::vector<std::unique_ptr<Thread>> workers;
+        for (unsigned i = 1; i < worker_count; ++i)
+            workers.push_back(std::make_unique<Thread>(
+                    fmt::format("zrif_worker_{}", i), [&, i] { check(i); }));
+        check(0);
+        for (auto& worker : workers)
+            worker->join();
+    }
+
+    std::vector<std::string> contents;
+    for (const auto& rows : bad_rows)
+        for (const auto row : rows)
+            contents.emplace_back(catalog.content(row));
+    return contents;
 }
 
-void TitleDatabase::update(Mode mode, Http* http, const std::string& update_url)
+void TitleDatabase::update(
+        Mode mode,
+        Http* http,
+        const std::string& update_url,
+        const std::function<void(uint64_t, uint64_t)>& progress)
 {
-    const auto tmppath = _dbPath + "/dbtmp.tsv";
+    const auto filepath =
+            fmt::format("{}/{}", _dbPath, pkgi_mode_to_file_name(mode));
+    // one temporary file per mode so that lists can be updated concurrently
+    const auto tmppath = filepath + ".tmp";
+    const auto statepath = list_state_path(filepath);
+
+    auto previous = pkgi_file_exists(filepath)
+                            ? load_list_state(statepath, true)
+                            : std::nullopt;
+
+    LOGF("cargando update desde {}", update_url);
+
+    if (previous && !previous->etag.empty())
+        http->add_request_header("If-None-Match", previous->etag);
+    if (previous && !previous->last_modified.empty())
+        http->add_request_header("If-Modified-Since", previous->last_modified);
+    http->add_request_header("Accept-Encoding", "gzip");
+
+    http->start(update_url, 0);
+
+    if (http->get_status() == 304)
+    {
+        LOGF("lista {} sin cambios", pkgi_mode_to_file_name(mode));
+        return;
+    }
+
+    const auto db_total = http->get_length();
+    // the list may be a .gz file or sent with a Content-Encoding
+    bool compressed = pkgi_is_compressed_encoding(
+            http->get_response_header("Content-Encoding"));
+
     auto item_file = pkgi_create(tmppath);
     BOOST_SCOPE_EXIT_ALL(&)
     {
@@ -282,105 +652,297 @@ void TitleDatabase::update(Mode mode, Http* http, const std::string& update_url)
     };
 
     std::vector<uint8_t> db_data(64 * 1024);
-    db_total = 0;
-    db_size = 0;
-
-    LOGF("cargando update desde {}", update_url);
-
-    http->start(update_url, 0);
+    int64_t db_size = 0;
+
+    sha256_ctx sha;
+    sha256_init(&sha);
+
+    // the list is parsed while it is downloaded, the file is only kept for
+    // the next start of pkgj. A list of the same size as the previous one is
+    // most likely the same list from a server without validators, it is only
+    // parsed once it is known to be different.
+    const bool parse_later = previous && previous->size == db_total;
+    auto catalog = std::make_unique<Catalog>();
+    std::vector<RowHash> row_hashes;
+    CatalogParser parser(mode, *catalog);
+    parser.collect_hashes(&row_hashes);
+    const auto feed = [&](uint8_t* data, size_t size) {
+        parser.feed(reinterpret_cast<const char*>(data), size);
+    };
 
-    db_total = http->get_length();
+    // the local copy is always stored as gzip, which is all parse_file
+    // recognises. A gzip list is stored as it was received, other lists are
+    // compressed again once inflated.
+    Inflater inflater;
+    Deflater deflater;
+    bool stored_as_is = false;
+    bool inflating = false;
+    const auto write = [&](uint8_t* data, size_t size) {
+        pkgi_write(item_file, data, size);
+    };
+    const auto inflated = [&](uint8_t* data, size_t size) {
+        if (!stored_as_is)
+            deflater.feed(data, size, write);
+        if (!parse_later)
+            feed(data, size);
+    };
 
     for (;;)
     {
         int read = http->read(db_data.data(), db_data.size());
         if (read == 0)
             break;
+
+        if (db_size == 0)
+        {
+            stored_as_is = pkgi_is_gzip(db_data.data(), read);
+            compressed = compressed || stored_as_is;
+            inflating = compressed && !(stored_as_is && parse_later);
+            if (!compressed && !parse_later)
+                parser.reserve(db_total);
+        }
         db_size += read;
 
-        pkgi_write(item_file, db_data.data(), read);
+        sha256_update(&sha, db_data.data(), read);
+        if (stored_as_is)
+            write(db_data.data(), read);
+        else if (!compressed)
+            deflater.feed(db_data.data(), read, write);
+
+        if (inflating)
+            inflater.feed(db_data.data(), read, inflated);
+        else if (!compressed && !parse_later)
+            feed(db_data.data(), read);
+
+        if (progress)
+            progress(db_size, db_total);
     }
 
     if (db_size == 0)
         throw std::runtime_error(
                 "lista vacia... mira una nueva version de pkgj");
-    if (db_size != db_total)
+    // compressed data ends with its own size and checksum, servers that
+    // compress on the fly often don't send a length
+    if (db_size != db_total && !(compressed && db_total <= 0))
         throw std::runtime_error(
                 "Archivo TSV truncado, comprueba tu conexion a Internet e "
                 "intentalo de nuevo.");
 
+    if (inflating)
+        inflater.finish();
+    if (!stored_as_is)
+        deflater.finish(write);
     pkgi_close(item_file);
     item_file = nullptr;
 
-    const auto filepath =
-            fmt::format("{}/{}", _dbPath, pkgi_mode_to_file_name(mode));
+    ListState state;
+    state.etag = http->get_response_header("ETag");
+    state.last_modified = http->get_response_header("Last-Modified");
+    state.size = db_size;
+    state.sha256.resize(SHA256_DIGEST_SIZE);
+    sha256_finish(&sha, state.sha256.data());
+
+    // servers without validators send the whole list again, there is
+    // nothing to do if it is the same
+    if (previous && previous->size == state.size &&
+        previous->sha256 == state.sha256)
+    {
+        pkgi_rm(tmppath.c_str());
+        state.new_contents = std::move(previous->new_contents);
+        state.updated_contents = std::move(previous->updated_contents);
+        state.bad_zrif_contents = std::move(previous->bad_zrif_contents);
+        state.content_hashes = std::move(previous->content_hashes);
+        state.line_hashes = std::move(previous->line_hashes);
+        save_list_state(statepath, state);
+        LOGF("lista {} sin cambios", pkgi_mode_to_file_name(mode));
+        return;
+    }
+
+    if (parse_later)
+        parse_file(tmppath, parser);
+    else
+        parser.finish();
+
+    // no row is flagged the first time the list is downloaded
+    diff_rows(*catalog, row_hashes, previous ? &*previous : nullptr, state);
+    LOGF("lista {}: {} nuevos, {} cambiados",
+         pkgi_mode_to_file_name(mode),
+         state.new_contents.size(),
+         state.updated_contents.size());
+
+    // a corrupt license is shown in the list instead of found at install.
+    // Lists are updated by several refresh workers at once, each checks its
+    // own list on its thread.
+    state.bad_zrif_contents = pkgi_find_bad_zrifs(*catalog, 1);
+    LOGF("lista {}: {} zRIF corruptos",
+         pkgi_mode_to_file_name(mode),
+         state.bad_zrif_contents.size());
 
     pkgi_rename(tmppath, filepath);
+    // written after the list, a state older than the list only costs a full
+    // download
+    save_list_state(statepath, state);
+
+    bool loaded;
+    {
+        ScopeLock lock(_lists_mutex);
+        // a preload that read the previous file must not be kept
+        ++_lists[mode].generation;
+        loaded = _lists[mode].catalog != nullptr;
+    }
+
+    // the loaded list is replaced on next reload, the items of the current
+    // one must stay valid until then
+    if (loaded)
+    {
+        finish_catalog(*catalog);
+        apply_flags(*catalog, state);
+
+        ScopeLock lock(_lists_mutex);
+        _lists[mode].next = std::move(catalog);
+    }
 
     LOG("descarga finalizada");
 }
 
-namespace
+std::unique_ptr<Catalog> TitleDatabase::load_catalog(Mode mode)
 {
-const char* region_to_string(GameRegion region)
+    auto catalog = std::make_unique<Catalog>();
+
+    const auto dbpath =
+            fmt::format("{}/{}", _dbPath, pkgi_mode_to_file_name(mode));
+
+    if (!pkgi_file_exists(dbpath))
+        return catalog;
+
+    CatalogParser parser(mode, *catalog);
+    parse_file(dbpath, parser);
+
+    finish_catalog(*catalog);
+
+    if (const auto state = load_list_state(list_state_path(dbpath), false))
+        apply_flags(*catalog, *state);
+
+    return catalog;
+}
+
+void TitleDatabase::preload(Mode mode)
 {
-    switch (region)
+    uint32_t generation;
     {
-    case RegionASA:
-        return "ASIA";
-    case RegionEUR:
-        return "EU";
-    case RegionJPN:
-        return "JP";
-    case RegionUSA:
-        return "US";
-    default:
-        throw std::runtime_error(fmt::format("region desconocida {}", (int)region));
+        ScopeLock lock(_lists_mutex);
+        if (_lists[mode].catalog)
+            return;
+        generation = _lists[mode].generation;
+    }
+
+    std::unique_ptr<Catalog> catalog;
+    try
+    {
+        catalog = load_catalog(mode);
+    }
+    catch (const std::exception& e)
+    {
+        LOGF("imposible precargar {}: {}",
+             pkgi_mode_to_file_name(mode),
+             e.what());
+        return;
+    }
+
+    ScopeLock lock(_lists_mutex);
+    // reload may have loaded it meanwhile, or update replaced the file
+    if (_lists[mode].catalog || _lists[mode].generation != generation)
+        return;
+
+    // preload never evicts, a list shown later would have to be parsed again
+    if (hidden_memory() + catalog->memory_usage() > _memory_budget)
+    {
+        LOGF("{} no cabe en memoria, no se precarga",
+             pkgi_mode_to_file_name(mode));
+        return;
     }
+
+    LOGF("{} precargado", pkgi_mode_to_file_name(mode));
+    _lists[mode].catalog = std::move(catalog);
 }
 
-std::set<std::string> filter_to_vector(uint32_t filter)
+size_t TitleDatabase::hidden_memory() const
 {
-    std::set<std::string> ret;
-#define HANDLE_REGION(reg)            \
-    if (filter & DbFilterRegion##reg) \
-    ret.insert(region_to_string(Region##reg))
-    HANDLE_REGION(ASA);
-    HANDLE_REGION(EUR);
-    HANDLE_REGION(JPN);
-    HANDLE_REGION(USA);
-#undef HANDLE_REGION
-    return ret;
+    size_t used = 0;
+    for (const auto& list : _lists)
+    {
+        if (list.catalog && list.catalog.get() != _catalog)
+            used += list.catalog->memory_usage();
+        if (list.next)
+            used += list.next->memory_usage();
+    }
+    return used;
 }
 
-bool lower(const DbItem& a, const DbItem& b, DbSort sort, DbSortOrder order)
+void TitleDatabase::evict_lists(uint32_t keep_modes)
 {
-    GameRegion reg_a = pkgi_get_region(a.titleid);
-    GameRegion reg_b = pkgi_get_region(b.titleid);
+    while (hidden_memory() > _memory_budget)
+    {
+        LoadedList* oldest = nullptr;
+        for (int i = 0; i < ModeCount; ++i)
+        {
+            auto& list = _lists[i];
+            if (list.catalog && list.catalog.get() != _catalog &&
+                !(keep_modes & (1 << i)) &&
+                (!oldest || list.last_used < oldest->last_used))
+                oldest = &list;
+        }
+        if (!oldest)
+            break;
+        oldest->catalog.reset();
+        oldest->next.reset();
+    }
+}
 
-    int64_t cmp;
-    if (sort == SortByTitle)
-        cmp = a.titleid.compare(b.titleid);
-    else if (sort == SortByRegion)
-        cmp = reg_a - reg_b;
-    else if (sort == SortByName)
-        cmp = pkgi_stricmp(a.name.c_str(), b.name.c_str());
-    else if (sort == SortBySize)
-        cmp = a.size - b.size;
-    else if (sort == SortByDate)
-        cmp = a.date.compare(b.date);
-    else
-        throw std::runtime_error(
-                fmt::format("orden desconocido {}", (int)sort));
+size_t TitleDatabase::memory_usage()
+{
+    ScopeLock lock(_lists_mutex);
+    size_t used = 0;
+    for (const auto& list : _lists)
+    {
+        if (list.catalog)
+            used += list.catalog->memory_usage();
+        if (list.next)
+            used += list.next->memory_usage();
+    }
+    return used;
+}
 
-    if (cmp == 0)
-        cmp = a.titleid.compare(b.titleid);
+Catalog* TitleDatabase::loaded_list(Mode mode)
+{
+    {
+        ScopeLock lock(_lists_mutex);
+        if (_lists[mode].catalog)
+            return _lists[mode].catalog.get();
+    }
 
-    if (order == SortDescending)
-        cmp = -cmp;
+    auto catalog = load_catalog(mode);
 
-    return cmp < 0;
+    ScopeLock lock(_lists_mutex);
+    // a preload may have been faster
+    if (!_lists[mode].catalog)
+        _lists[mode].catalog = std::move(catalog);
+    return _lists[mode].catalog.get();
 }
+
+const std::vector<uint32_t>& TitleDatabase::search_catalog(
+        const std::string& search)
+{
+    if (search == _search)
+        return _search_rows;
+
+    if (!_search.empty() &&
+        pkgi_stricontains(search.c_str(), _search.c_str()))
+        _search_rows = _catalog->search(search, &_search_rows);
+    else
+        _search_rows = _catalog->search(search);
+    _search = search;
+    return _search_rows;
 }
 
 void TitleDatabase::reload(
@@ -389,134 +951,98 @@ void TitleDatabase::reload(
         DbSort sort_by,
         DbSortOrder sort_order,
         const std::string& search,
-        const std::set<std::string>& installed_games)
+        const std::unordered_set<std::string>& installed_games)
 {
     const auto filter_by_region =
             (region_filter & DbFilterAllRegions) != DbFilterAllRegions;
-    const auto regions = filter_to_vector(region_filter);
 
-    db.clear();
+    _view.clear();
+    _presence.clear();
+    _db_index.clear();
+    for (auto& cached : _items)
+        cached.index = UINT32_MAX;
     _title_count = 0;
 
-    const auto dbpath =
-            fmt::format("{}/{}", _dbPath, pkgi_mode_to_file_name(mode));
+    {
+        ScopeLock lock(_lists_mutex);
+        // the items of the previous list were dropped above, the lists parsed
+        // by update can replace the loaded ones
+        for (auto& list : _lists)
+            if (list.next)
+                list.catalog = std::move(list.next);
+    }
 
-    if (!pkgi_file_exists(dbpath))
-        return;
+    Catalog* shown;
+    try
+    {
+        shown = loaded_list(mode);
+    }
+    catch (const std::exception&)
+    {
+        ScopeLock lock(_lists_mutex);
+        _catalog = nullptr;
+        _search.clear();
+        _search_rows.clear();
+        throw;
+    }
+
+    {
+        ScopeLock lock(_lists_mutex);
+        if (shown != _catalog || mode != _catalog_mode)
+        {
+            _search.clear();
+            _search_rows.clear();
+        }
+        _catalog = shown;
+        _catalog_mode = mode;
+        _lists[mode].last_used = ++_reload_count;
+        evict_lists();
+    }
 
-    auto db_data = pkgi_load(dbpath);
+    const auto& catalog = *_catalog;
+    _title_count = catalog.size();
 
-    auto ptr = reinterpret_cast<char*>(db_data.data());
-    const auto end = reinterpret_cast<char*>(db_data.data() + db_data.size());
+    std::vector<bool> installed;
+    if (region_filter & DbFilterInstalled)
+    {
+        installed.resize(catalog.size());
+        for (const auto& titleid : installed_games)
+            for (const auto row : catalog.find_titleid(titleid))
+                installed[row] = true;
+    }
 
-    // skip header
-    while (ptr < end && *ptr != '\n')
-        ptr++;
-    if (ptr == end)
-        return;
-    ptr++; // \n
+    const auto* matches = search.empty() ? nullptr : &search_catalog(search);
+    const uint32_t candidates = matches ? matches->size() : catalog.size();
 
-    unsigned line = 1;
-    while (ptr < end && *ptr)
+    std::vector<uint32_t> rows;
+    rows.reserve(candidates);
+    for (uint32_t i = 0; i < candidates; ++i)
     {
-        ++line;
-        try
-        {
-            const auto fields = pkgi_split_row(&ptr, end);
-
-            const std::string content =
-                    get_or_empty(mode, fields, Column::Content);
-            const std::string titleid =
-                    content.size() >= 7 + 9 ? content.substr(7, 9) : "";
-            const auto region = get_or_empty(mode, fields, Column::Region);
-            const std::string name = get_or_empty(mode, fields, Column::Name);
-            const auto name_org = get_or_empty(mode, fields, Column::NameOrg);
-            const auto url = get_or_empty(mode, fields, Column::Url);
-            const auto zrif = get_or_empty(mode, fields, Column::Zrif);
-            const auto digest = get_or_empty(mode, fields, Column::Digest);
-            const std::string size = get_or_empty(mode, fields, Column::Size);
-            const std::string fw_version =
-                    get_or_empty(mode, fields, Column::FwVersion);
-            const auto last_modification =
-                    get_or_empty(mode, fields, Column::LastModification);
-            const std::string app_version =
-                    get_or_empty(mode, fields, Column::AppVersion);
-
-            if (*url == '\0' || std::string(url) == "MISSING" ||
-                std::string(url) == "CART ONLY" ||
-                std::string(zrif) == "MISSING")
-                continue;
-
-            ++_title_count;
-
-            if (filter_by_region && !regions.count(region))
-                continue;
-
-            if (!search.empty() &&
-                !pkgi_stricontains(name.c_str(), search.c_str()) &&
-                !pkgi_stricontains(titleid.c_str(), search.c_str()))
-                continue;
-
-            bool bdigest = true;
-            std::array<uint8_t, 32> digest_array{};
-            if (std::all_of(
-                        digest,
-                        digest + 64,
-                        [](const auto c) { return c != 0; }))
-                digest_array = pkgi_hexbytes(digest, SHA256_DIGEST_SIZE);
-            else
-                bdigest = false;
+        const auto row = matches ? (*matches)[i] : i;
 
-            std::string full_name = name;
-            if (!app_version.empty())
-                full_name = fmt::format("{} ({})", name, app_version);
-            if (!name.empty() && name.back() != ']' && fw_version > "3.60")
-                full_name = fmt::format("{} [{}]", full_name, fw_version);
+        if (filter_by_region && !(catalog.region(row) & region_filter))
+            continue;
 
-            if (!(region_filter & DbFilterInstalled) ||
-                installed_games.find(titleid) != installed_games.end())
-                db.push_back(DbItem{
-                        PresenceUnknown,
-                        titleid,
-                        content,
-                        0,
-                        full_name,
-                        name_org ? name_org : "",
-                        zrif ? zrif : "",
-                        url,
-                        static_cast<bool>(bdigest),
-                        digest_array,
-                        size.empty() ? 0 : std::stoll(size),
-                        last_modification,
-                        app_version,
-                        fw_version,
-                });
-        }
-        catch (const std::exception& e)
-        {
-            throw formatEx<std::runtime_error>(
-                    "fallo al parsear linea {}: {}", line, e.what());
-        }
+        if (!installed.empty() && !installed[row])
+            continue;
+
+        rows.push_back(row);
     }
 
-    std::sort(
-            db.begin(),
-            db.end(),
-            [&](const auto& a, const auto& b)
-            { return lower(a, b, sort_by, sort_order); });
+    catalog.sort(rows, sort_by, sort_order);
 
-    LOGF("recargados {}/{} objetos", db.size(), _title_count);
-}
+    _db_index.assign(catalog.size(), UINT32_MAX);
+    for (uint32_t i = 0; i < rows.size(); ++i)
+        _db_index[rows[i]] = i;
+    _view = std::move(rows);
+    _presence.assign(_view.size(), PresenceUnknown);
 
-void TitleDatabase::get_update_status(uint32_t* updated, uint32_t* total)
-{
-    *updated = db_size;
-    *total = db_total;
+    LOGF("recargados {}/{} objetos", _view.size(), _title_count);
 }
 
 uint32_t TitleDatabase::count()
 {
-    return db.size();
+    return _view.size();
 }
 
 uint32_t TitleDatabase::total()
@@ -526,23 +1052,128 @@ uint32_t TitleDatabase::total()
 
 DbItem* TitleDatabase::get(uint32_t index)
 {
-    return index < db.size() ? &db[index] : NULL;
+    if (index >= _view.size())
+        return NULL;
+
+    CachedItem* oldest = &_items[0];
+    for (auto& cached : _items)
+    {
+        if (cached.index == index)
+        {
+            cached.last_used = ++_get_count;
+            return &cached.item;
+        }
+        if (cached.last_used < oldest->last_used)
+            oldest = &cached;
+    }
+
+    if (oldest->index != UINT32_MAX)
+        _presence[oldest->index] = oldest->item.presence;
+    oldest->index = index;
+    oldest->last_used = ++_get_count;
+    oldest->item = _catalog->get(_view[index]);
+    oldest->item.presence = static_cast<DbPresence>(_presence[index]);
+    return &oldest->item;
 }
 
 DbItem* TitleDatabase::get_by_content(const char* content)
 {
-    for (size_t i = 0; i < db.size(); ++i)
-        if (db[i].content == content)
-            return &db[i];
-    return NULL;
+    if (!_catalog)
+        return NULL;
+    const auto row = _catalog->find_content(content);
+    if (!row || *row >= _db_index.size() || _db_index[*row] == UINT32_MAX)
+        return NULL;
+    return get(_db_index[*row]);
+}
+
+void TitleDatabase::clear_presence()
+{
+    std::fill(_presence.begin(), _presence.end(), PresenceUnknown);
+    for (auto& cached : _items)
+        cached.item.presence = PresenceUnknown;
+}
+
+std::vector<DbMatch> TitleDatabase::find_by_content(std::string_view content)
+{
+    std::vector<DbMatch> matches;
+    ScopeLock lock(_lists_mutex);
+    for (int i = 0; i < ModeCount; ++i)
+    {
+        const auto& catalog = _lists[i].catalog;
+        if (!catalog)
+            continue;
+        if (const auto row = catalog->find_content(content))
+            matches.push_back(
+                    DbMatch{static_cast<Mode>(i), catalog->get(*row)});
+    }
+    return matches;
+}
+
+std::vector<DbMatch> TitleDatabase::find_by_titleid(std::string_view titleid)
+{
+    std::vector<DbMatch> matches;
+    ScopeLock lock(_lists_mutex);
+    for (int i = 0; i < ModeCount; ++i)
+    {
+        const auto& catalog = _lists[i].catalog;
+        if (!catalog)
+            continue;
+        for (const auto row : catalog->find_titleid(titleid))
+            matches.push_back(DbMatch{static_cast<Mode>(i), catalog->get(row)});
+    }
+    return matches;
+}
+
+std::vector<DbModeMatches> TitleDatabase::search_all(
+        const std::string& search, uint32_t max_items)
+{
+    std::vector<DbModeMatches> result;
+    // lists the items point into
+    uint32_t matched_modes = 0;
+    for (int i = 0; i < ModeCount; ++i)
+    {
+        const auto mode = static_cast<Mode>(i);
+        const auto& catalog = *loaded_list(mode);
+
+        auto rows = catalog.search(search);
+        if (rows.empty())
+            continue;
+        matched_modes |= 1 << i;
+
+        DbModeMatches matches{mode, static_cast<uint32_t>(rows.size()), {}};
+        if (rows.size() > max_items)
+        {
+            // only the first items are shown, sorting all the matches of a
+            // short search would cost more than the search itself
+            std::partial_sort(
+                    rows.begin(),
+                    rows.begin() + max_items,
+                    rows.end(),
+                    [&](uint32_t a, uint32_t b)
+                    { return catalog.compare(a, b, SortByName) < 0; });
+            rows.resize(max_items);
+        }
+        else
+            catalog.sort(rows, SortByName, SortAscending);
+
+        matches.items.reserve(rows.size());
+        for (const auto row : rows)
+            matches.items.push_back(catalog.get(row));
+        result.push_back(std::move(matches));
+    }
+
+    // the lists loaded only to be searched don't stay over the budget
+    ScopeLock lock(_lists_mutex);
+    evict_lists(matched_modes);
+    return result;
 }
 
-GameRegion pkgi_get_region(const std::string& titleid)
+GameRegion pkgi_get_region(std::string_view titleid)
 {
     if (titleid.size() < 4)
         return RegionUnknown;
 
-    uint32_t first = get32le((uint8_t*)titleid.c_str());
+    uint32_t first = get32le((const uint8_t*)titleid.data());
 
 #define ID(a, b, c, d)                                    \
     (uint32_t)(                                           \
@@ -1,11 +1,15 @@
 #pragma once
 
 #include "http.hpp"
+#include "thread.hpp"
 
 #include <array>
+#include <functional>
 #include <memory>
-#include <set>
+#include <mutex>
+#include <unordered_set>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include <cstdint>
@@ -49,22 +53,34 @@ enum DbFilter
     DbFilterAll = DbFilterAllRegions,
 };
 
+enum DbItemFlags
+{
+    // the row was not in the previous version of the list
+    DbItemNew = 0x01,
+    // the row was in the previous version of the list but has changed
+    DbItemUpdated = 0x02,
+    // the zRIF of the row can't be decoded
+    DbItemBadZrif = 0x04,
+};
+
+// View of a row of the title list, the strings are null-terminated and stay
+// valid until the next reload of the list
 struct DbItem
 {
     DbPresence presence;
-    std::string titleid;
-    std::string content;
-    uint32_t flags;
-    std::string name;
-    std::string name_org;
-    std::string zrif;
-    std::string url;
-    bool has_digest;
-    std::array<uint8_t, 32> digest;
+    std::string_view titleid;
+    std::string_view content;
+    uint32_t flags; // DbItemFlags
+    std::string_view name;
+    std::string_view name_org;
+    std::string_view zrif;
+    std::string_view url;
+    // SHA256_DIGEST_SIZE bytes, nullptr if the list has no digest
+    const uint8_t* digest;
     int64_t size;
-    std::string date;
-    std::string app_version;
-    std::string fw_version;
+    std::string_view date;
+    std::string_view app_version;
+    std::string_view fw_version;
 };
 
 enum GameRegion
@@ -96,10 +112,34 @@ static constexpr auto ModeCount = 8;
 
 std::string pkgi_mode_to_string(Mode mode);
 
+class Catalog;
+
+struct DbMatch
+{
+    Mode mode;
+    DbItem item;
+};
+
+// matches of a search in the list of a mode
+struct DbModeMatches
+{
+    Mode mode;
+    // matching rows in the list, items holds at most the number asked
+    uint32_t count;
+    // sorted by name
+    std::vector<DbItem> items;
+};
+
 class TitleDatabase
 {
 public:
-    TitleDatabase(const std::string& dbPath);
+    // memory the lists of the modes that aren't shown may keep
+    static constexpr size_t DEFAULT_MEMORY_BUDGET = 48 * 1024 * 1024;
+
+    TitleDatabase(
+            const std::string& dbPath,
+            size_t memory_budget = DEFAULT_MEMORY_BUDGET);
+    ~TitleDatabase();
 
     void reload(
             Mode mode,
@@ -107,25 +147,116 @@ public:
             DbSort sort_by,
             DbSortOrder sort_order,
             const std::string& search,
-            const std::set<std::string>& installed_games);
+            const std::unordered_set<std::string>& installed_games);
+
+    // can run concurrently for different modes and with preload, but not
+    // with reload
+    void update(
+            Mode mode,
+            Http* http,
+            const std::string& update_url,
+            const std::function<void(uint64_t, uint64_t)>& progress = {});
 
-    void update(Mode mode, Http* http, const std::string& update_url);
-    void get_update_status(uint32_t* updated, uint32_t* total);
+    // parses the list of mode if it isn't loaded yet, so that switching to
+    // it later is instant. Meant to run in the background, concurrently with
+    // reload and update. Does nothing if the list doesn't fit in the memory
+    // budget.
+    void preload(Mode mode);
+    // memory used by all the loaded lists
+    size_t memory_usage();
 
     uint32_t count();
     uint32_t total();
+    // items are decoded on demand, they stay valid until the next reload or
+    // until CACHED_ITEMS other items are got
     DbItem* get(uint32_t index);
     DbItem* get_by_content(const char* content);
+    // makes the presence of every item unknown, to be checked again
+    void clear_presence();
+
+    // items of the loaded lists, valid until the next reload
+    std::vector<DbMatch> find_by_content(std::string_view content);
+    std::vector<DbMatch> find_by_titleid(std::string_view titleid);
+
+    // searches the names and title ids of the lists of all the modes at
+    // once, loading the lists that aren't. Modes without matches are left
+    // out, their lists are dropped again if they don't fit in the memory
+    // budget. Items are valid until the next reload or search_all.
+    std::vector<DbModeMatches> search_all(
+            const std::string& search, uint32_t max_items = 100);
 
 private:
-    static constexpr auto MAX_DB_ITEMS = 8192;
+    // items decoded by get, the list only draws a screenful of them
+    static constexpr auto CACHED_ITEMS = 64;
 
     std::string _dbPath;
-    uint32_t db_total;
-    uint32_t db_size;
     uint32_t _title_count;
 
-    std::vector<DbItem> db;
+    // parsed list of a mode, kept when another mode is shown so that
+    // switching back doesn't parse it again
+    struct LoadedList
+    {
+        std::unique_ptr<Catalog> catalog;
+        // parsed by update, replaces catalog on next reload
+        std::unique_ptr<Catalog> next;
+        // incremented each time the file of the list is replaced
+        uint32_t generation = 0;
+        // value of _reload_count when the list was last shown
+        uint64_t last_used = 0;
+    };
+
+    using ScopeLock = std::lock_guard<Mutex>;
+
+    // guards _lists and _catalog, catalogs are only destroyed by reload and
+    // search_all
+    Mutex _lists_mutex;
+    std::array<LoadedList, ModeCount> _lists;
+    uint64_t _reload_count = 0;
+    size_t _memory_budget;
+
+    // list shown, in _lists
+    Catalog* _catalog = nullptr;
+    Mode _catalog_mode;
+
+    // rows matching the last search, a longer search containing it can only
+    // match a subset of them
+    std::string _search;
+    std::vector<uint32_t> _search_rows;
+
+    // rows of the catalog shown, in order
+    std::vector<uint32_t> _view;
+    // presence of the rows of _view, kept when their item leaves the cache
+    std::vector<uint8_t> _presence;
+    // index in _view of each row of the catalog, UINT32_MAX if filtered out
+    std::vector<uint32_t> _db_index;
+
+    struct CachedItem
+    {
+        uint32_t index = UINT32_MAX; // in _view
+        uint64_t last_used = 0;
+        DbItem item;
+    };
+
+    std::array<CachedItem, CACHED_ITEMS> _items;
+    uint64_t _get_count = 0;
+
+    std::unique_ptr<Catalog> load_catalog(Mode mode);
+    // list of mode, loaded if it isn't
+    Catalog* loaded_list(Mode mode);
+    // memory of the lists not shown, with _lists_mutex held
+    size_t hidden_memory() const;
+    // keep_modes is a mask of 1 << Mode of lists that must not be dropped
+    void evict_lists(uint32_t keep_modes = 0);
+    const std::vector<uint32_t>& search_catalog(const std::string& search);
 };
 
-GameRegion pkgi_get_region(const std::string& titleid);
+GameRegion pkgi_get_region(std::string_view titleid);
+
+// parses a whole title list into catalog, without building its indexes
+void pkgi_parse_catalog(
+        Mode mode, const char* data, size_t size, Catalog& catalog);
+
+// decodes the zRIFs of all the rows of catalog with worker_count threads and
+// returns the content ids of the rows whose zRIF is corrupt
+std::vector<std::string> pkgi_find_bad_zrifs(
+        const Catalog& catalog, unsigned worker_count);
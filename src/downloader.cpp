@@ -1,6 +1,7 @@
 #include "downloader.hpp"
 
 #include "download.hpp"
+#include "extractzip.hpp"
 #include "file.hpp"
 #include "filedownload.hpp"
 #include "install.hpp"
@@ -56,30 +57,24 @@ void Downloader::add(const DownloadItem& d)
     LOG("añadiendo descarga %s", d.name.c_str());
     {
         ScopeLock _(_cond.get_mutex());
-        _queue.push_back(d);
+        _queue.push(d);
+        _queue_generation = _queue.generation();
     }
     _cond.notify_one();
 }
 
-bool Downloader::is_in_queue(Type type, const std::string& contentid)
+bool Downloader::is_in_queue(Type type, std::string_view contentid)
 {
     ScopeLock _(_cond.get_mutex());
-    if (type == _current_download.type &&
-        contentid == _current_download.content)
-        return true;
-
-    for (const auto& item : _queue)
-        if (item.type == type && item.content == contentid)
-            return true;
-    return false;
+    return _queue.contains(type, contentid);
 }
 
 std::optional<DownloadItem> Downloader::get_current_download()
 {
     ScopeLock _(_cond.get_mutex());
-    if (_current_download.content.empty())
+    if (_queue.current().content.empty())
         return std::nullopt;
-    return _current_download;
+    return _queue.current();
 }
 
 std::tuple<uint64_t, uint64_t> Downloader::get_current_download_progress()
@@ -87,22 +82,12 @@ std::tuple<uint64_t, uint64_t> Downloader::get_current_download_progress()
     return {_download_offset.load(), _download_size.load()};
 }
 
-void Downloader::remove_from_queue(Type type, const std::string& contentid)
+void Downloader::remove_from_queue(Type type, std::string_view contentid)
 {
     ScopeLock _(_cond.get_mutex());
-    if (type == _current_download.type &&
-        contentid == _current_download.content)
+    if (!_queue.remove(type, contentid))
         _cancel_current = true;
-    else
-        _queue.erase(
-                std::remove_if(
-                        _queue.begin(),
-                        _queue.end(),
-                        [&](auto const& item) {
-                            return item.type == type &&
-                                   item.content == contentid;
-                        }),
-                _queue.end());
+    _queue_generation = _queue.generation();
 }
 
 void Downloader::run()
@@ -113,18 +98,16 @@ void Downloader::run()
         {
             ScopeLock _(_cond.get_mutex());
 
-            _current_download = {};
+            _queue.finish_current();
+            _queue_generation = _queue.generation();
             _cancel_current = false;
             _download_offset = 0;
             _download_size = 0;
 
             if (_dying)
                 return;
-            else if (!_queue.empty())
-            {
-                item = _current_download = _queue.front();
-                _queue.pop_front();
-            }
+            else if (_queue.start_next())
+                item = _queue.current();
             else
                 _cond.wait();
         }
@@ -213,25 +196,58 @@ void Downloader::do_download_comppack(const DownloadItem& item)
     };
 
     ScopeProcessLock _;
-    LOGF("descargando packcomp {}", item.url);
-    auto download =
-            std::make_unique<FileDownload>(std::make_unique<VitaHttp>());
-
-    download->update_progress_cb =
+    const auto progress =
             [this](uint64_t download_offset, uint64_t download_size)
     {
         _download_offset = download_offset;
         _download_size = download_size;
     };
-    download->is_canceled = [this] { return _cancel_current || _dying; };
+    const auto is_canceled = [this] { return _cancel_current || _dying; };
 
-    download->download(
-            item.partition.c_str(), item.content.c_str(), item.url.c_str());
-    LOGF("descarga de packcomp {} completada!", item.url);
-    pkgi_install_comppack(
-            item.content, item.type == CompPackPatch, item.version);
-    pkgi_rm(fmt::format("{}pkgj/{}-comp.ppk", item.partition, item.content)
-                    .c_str());
+    try
+    {
+        // the pack is extracted as it downloads, it is written to the
+        // memory card once instead of being saved, read back and deleted
+        pkgi_install_comppack(
+                item.content,
+                item.type == CompPackPatch,
+                item.version,
+                [&](const std::string& dest)
+                {
+                    pkgi_extract_zip_stream(
+                            [] { return std::make_unique<VitaHttp>(); },
+                            item.url,
+                            dest,
+                            progress,
+                            is_canceled);
+                });
+    }
+    catch (const ZipStreamUnsupported& e)
+    {
+        LOGF("packcomp {} no extraible durante la descarga: {}",
+             item.url,
+             e.what());
+
+        const auto path =
+                fmt::format("{}pkgj/{}-comp.ppk", item.partition, item.content);
+
+        auto download =
+                std::make_unique<FileDownload>(std::make_unique<VitaHttp>());
+        download->update_progress_cb = progress;
+        download->is_canceled = is_canceled;
+        download->download(
+                item.partition.c_str(),
+                item.content.c_str(),
+                item.url.c_str());
+        LOGF("descarga de packcomp {} completada!", item.url);
+
+        pkgi_install_comppack(
+                item.content,
+                item.type == CompPackPatch,
+                item.version,
+                [&](const std::string& dest) { pkgi_extract_zip(path, dest); });
+        pkgi_rm(path.c_str());
+    }
     LOG("instalacion de %s completada!", item.name.c_str());
 }
 
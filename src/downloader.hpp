@@ -1,41 +1,15 @@
 #pragma once
 
 #include <atomic>
-#include <deque>
 #include <mutex>
 #include <optional>
+#include <string_view>
 #include <tuple>
 #include <vector>
 
+#include "downloadqueue.hpp"
 #include "thread.hpp"
 
-enum Type
-{
-    Game,
-    Patch,
-    Dlc,
-    PsmGame,
-    PsxGame,
-    PspGame,
-    PspDlc,
-    CompPackBase,
-    CompPackPatch,
-};
-
-struct DownloadItem
-{
-    Type type;
-    std::string name;
-    std::string content;
-    std::string url;
-    std::vector<uint8_t> rif;
-    std::vector<uint8_t> digest;
-    bool save_as_iso;
-    std::string partition;
-    // only used by compatibility packs
-    std::string version;
-};
-
 std::string type_to_string(Type type);
 
 class Downloader
@@ -50,8 +24,14 @@ public:
     ~Downloader();
 
     void add(const DownloadItem& d);
-    void remove_from_queue(Type type, const std::string& contentid);
-    bool is_in_queue(Type type, const std::string& titleid);
+    void remove_from_queue(Type type, std::string_view contentid);
+    bool is_in_queue(Type type, std::string_view contentid);
+    // changes each time the queue does, rows shown as queued only need to be
+    // checked again when it changes
+    uint32_t queue_generation() const
+    {
+        return _queue_generation;
+    }
     std::optional<DownloadItem> get_current_download();
     std::tuple<uint64_t, uint64_t> get_current_download_progress();
 
@@ -62,9 +42,9 @@ private:
     using ScopeLock = std::lock_guard<Mutex>;
 
     Cond _cond;
-    std::deque<DownloadItem> _queue;
+    DownloadQueue _queue;
+    std::atomic<uint32_t> _queue_generation = 0;
 
-    DownloadItem _current_download;
     bool _cancel_current = false;
     std::atomic<uint64_t> _download_offset = 0;
     std::atomic<uint64_t> _download_size = 0;
@@ -0,0 +1,73 @@
+#include "downloadqueue.hpp"
+
+#include <algorithm>
+
+const std::string& DownloadQueue::key(Type type, std::string_view content)
+{
+    _key.assign(content);
+    _key.push_back('\0');
+    _key.push_back(static_cast<char>(type));
+    return _key;
+}
+
+void DownloadQueue::add_key(const DownloadItem& item)
+{
+    ++_keys[key(item.type, item.content)];
+}
+
+void DownloadQueue::remove_key(const DownloadItem& item)
+{
+    const auto it = _keys.find(key(item.type, item.content));
+    if (it != _keys.end() && --it->second == 0)
+        _keys.erase(it);
+}
+
+void DownloadQueue::push(const DownloadItem& item)
+{
+    _queue.push_back(item);
+    add_key(item);
+    ++_generation;
+}
+
+bool DownloadQueue::start_next()
+{
+    if (_queue.empty())
+        return false;
+    // the key moves along with the item
+    _current = std::move(_queue.front());
+    _queue.pop_front();
+    return true;
+}
+
+void DownloadQueue::finish_current()
+{
+    if (_current.content.empty())
+        return;
+    remove_key(_current);
+    _current = {};
+    ++_generation;
+}
+
+bool DownloadQueue::remove(Type type, std::string_view content)
+{
+    if (type == _current.type && content == _current.content)
+        return false;
+
+    if (!contains(type, content))
+        return true;
+
+    const auto it = std::remove_if(
+            _queue.begin(),
+            _queue.end(),
+            [&](const DownloadItem& item)
+            { return item.type == type && item.content == content; });
+    _queue.erase(it, _queue.end());
+    _keys.erase(key(type, content));
+    ++_generation;
+    return true;
+}
+
+bool DownloadQueue::contains(Type type, std::string_view content)
+{
+    return _keys.find(key(type, content)) != _keys.end();
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <cstdint>
+
+enum Type
+{
+    Game,
+    Patch,
+    Dlc,
+    PsmGame,
+    PsxGame,
+    PspGame,
+    PspDlc,
+    CompPackBase,
+    CompPackPatch,
+};
+
+struct DownloadItem
+{
+    Type type;
+    std::string name;
+    std::string content;
+    std::string url;
+    std::vector<uint8_t> rif;
+    std::vector<uint8_t> digest;
+    bool save_as_iso;
+    std::string partition;
+    // only used by compatibility packs
+    std::string version;
+};
+
+// Pending downloads and the one in progress, with a hash of their (type,
+// content) keys so that checking whether a row is queued doesn't scan the
+// queue. Not thread safe.
+class DownloadQueue
+{
+public:
+    void push(const DownloadItem& item);
+    // moves the first pending download to current, false if there is none
+    bool start_next();
+    void finish_current();
+    // returns false if the download is current, it is then left for the
+    // caller to cancel
+    bool remove(Type type, std::string_view content);
+
+    bool contains(Type type, std::string_view content);
+    bool empty() const
+    {
+        return _queue.empty();
+    }
+    // empty content when there is no download in progress
+    const DownloadItem& current() const
+    {
+        return _current;
+    }
+
+    // changes each time a download is added, removed or finished
+    uint32_t generation() const
+    {
+        return _generation;
+    }
+
+private:
+    std::deque<DownloadItem> _queue;
+    DownloadItem _current{};
+    // number of downloads in _queue and _current with each key
+    std::unordered_map<std::string, uint32_t> _keys;
+    // reused to build the keys looked up
+    std::string _key;
+    uint32_t _generation = 0;
+
+    const std::string& key(Type type, std::string_view content);
+    void add_key(const DownloadItem& item);
+    void remove_key(const DownloadItem& item);
+};
@@ -2,29 +2,69 @@
 
 #include "file.hpp"
 #include "pkgi.hpp"
+#include "thread.hpp"
 
 #include <zip.h>
 
+#include <fmt/format.h>
+
 #include <boost/scope_exit.hpp>
 
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <vector>
+
 #if __arm__
 extern const char _ctype_[];
 // For some reason bzip2 needs this, and it isn't defined by the toolchain
 const char* __ctype_ptr__ = _ctype_;
 #endif
 
-void pkgi_extract_zip(const std::string& zip_file, const std::string& dest)
+namespace
+{
+// apps get 3 cores of the Vita, and a worker waiting on the memory card
+// leaves its core to the others
+constexpr unsigned EXTRACT_WORKERS = 3;
+// each worker reuses its buffer for all its files, and only writes it full
+constexpr auto WRITE_SIZE = 256 * 1024;
+// connections of a streamed zip that may drop in a row without a single
+// entry being extracted
+constexpr unsigned STREAM_RETRIES = 3;
+
+struct ZipEntry
+{
+    zip_uint64_t index;
+    std::string path;
+    uint64_t size;
+};
+
+zip_t* open_zip(const std::string& zip_file)
 {
     int err;
     const auto zip_fd = zip_open(zip_file.c_str(), ZIP_RDONLY, &err);
     if (!zip_fd)
         throw formatEx<std::runtime_error>(
                 "fallo al abrir zip {}:\n{}", zip_file, err);
+    return zip_fd;
+}
+
+// Lists the files of the zip, largest first so that a big file doesn't end
+// up alone at the end of the extraction, and the directories they need.
+// Only the deepest directories are kept, creating them creates the others.
+void plan_extraction(
+        const std::string& zip_file,
+        std::vector<ZipEntry>& files,
+        std::vector<std::string>& directories)
+{
+    const auto zip_fd = open_zip(zip_file);
     BOOST_SCOPE_EXIT_ALL(&)
     {
         zip_close(zip_fd);
     };
 
+    std::set<std::string> all_directories;
     const auto num_entries = zip_get_num_entries(zip_fd, 0);
     for (auto i = 0; i < num_entries; ++i)
     {
@@ -42,46 +82,549 @@ void pkgi_extract_zip(const std::string& zip_file, const std::string& dest)
             throw std::runtime_error("zip no soportado: sin tamaño");
 
         std::string path = stat.name;
+        if (path.empty())
+            continue;
         if (path[path.size() - 1] == '/')
         {
-            LOGF("creando directorio {}", path);
-            pkgi_mkdirs((dest + '/' + path).c_str());
+            path.pop_back();
+            all_directories.insert(path);
         }
         else
         {
-            LOGF("descomprimiendo archivo {}", path);
-            const auto comp_fd = zip_fopen_index(zip_fd, i, 0);
-            if (!comp_fd)
-                throw formatEx<std::runtime_error>(
-                        "imposible zip_fopen index {} de {}:\n{}",
-                        i,
-                        zip_file,
-                        zip_strerror(zip_fd));
+            const auto slash = path.rfind('/');
+            if (slash != std::string::npos)
+                all_directories.insert(path.substr(0, slash));
+            files.push_back(ZipEntry{
+                    static_cast<zip_uint64_t>(i), std::move(path), stat.size});
+        }
+    }
+
+    for (auto it = all_directories.begin(); it != all_directories.end(); ++it)
+    {
+        // in a sorted set, subdirectories come right after their parent
+        const auto next = std::next(it);
+        if (next != all_directories.end() &&
+            next->compare(0, it->size() + 1, *it + '/') == 0)
+            continue;
+        directories.push_back(*it);
+    }
+
+    std::stable_sort(
+            files.begin(),
+            files.end(),
+            [](const ZipEntry& lhs, const ZipEntry& rhs)
+            { return lhs.size > rhs.size; });
+}
+
+class ZipExtractor
+{
+public:
+    ZipExtractor(
+            const std::string& zip_file,
+            const std::string& dest,
+            const std::vector<ZipEntry>& files)
+        : _mutex("extract_mutex")
+        , _zip_file(zip_file)
+        , _dest(dest)
+        , _files(files)
+    {
+    }
+
+    void run()
+    {
+        const auto worker_count = std::max(
+                1u, std::min<unsigned>(EXTRACT_WORKERS, _files.size()));
+
+        std::vector<std::unique_ptr<Thread>> workers;
+        for (unsigned i = 0; i < worker_count; ++i)
+            workers.push_back(std::make_unique<Thread>(
+                    fmt::format("extract_worker_{}", i),
+                    [this] { do_work(); }));
+        for (auto& worker : workers)
+            worker->join();
+
+        if (!_error.empty())
+            throw std::runtime_error(_error);
+    }
+
+private:
+    using ScopeLock = std::lock_guard<Mutex>;
+
+    Mutex _mutex;
+    const std::string& _zip_file;
+    const std::string& _dest;
+    const std::vector<ZipEntry>& _files;
+    size_t _next_file = 0;
+    // the first error, the other workers stop once it is set
+    std::string _error;
+
+    void do_work()
+    {
+        try
+        {
+            // a zip_t can't be read from several threads
+            const auto zip_fd = open_zip(_zip_file);
             BOOST_SCOPE_EXIT_ALL(&)
             {
-                zip_fclose(comp_fd);
+                zip_close(zip_fd);
             };
 
-            const auto out_fd = pkgi_create((dest + '/' + path).c_str());
-            if (!out_fd)
-                throw formatEx<std::runtime_error>("imposible abrir archivo {}", path);
-            BOOST_SCOPE_EXIT_ALL(&)
+            std::vector<uint8_t> buffer(WRITE_SIZE);
+            for (;;)
             {
-                pkgi_close(out_fd);
-            };
+                const ZipEntry* file;
+                {
+                    ScopeLock lock(_mutex);
+                    if (!_error.empty() || _next_file == _files.size())
+                        return;
+                    file = &_files[_next_file++];
+                }
+
+                extract_file(zip_fd, *file, buffer);
+            }
+        }
+        catch (const std::exception& e)
+        {
+            ScopeLock lock(_mutex);
+            if (_error.empty())
+                _error = e.what();
+        }
+    }
+
+    void extract_file(
+            zip_t* zip_fd, const ZipEntry& file, std::vector<uint8_t>& buffer)
+    {
+        LOGF("descomprimiendo archivo {}", file.path);
+        const auto comp_fd = zip_fopen_index(zip_fd, file.index, 0);
+        if (!comp_fd)
+            throw formatEx<std::runtime_error>(
+                    "imposible zip_fopen index {} de {}:\n{}",
+                    file.index,
+                    _zip_file,
+                    zip_strerror(zip_fd));
+        BOOST_SCOPE_EXIT_ALL(&)
+        {
+            zip_fclose(comp_fd);
+        };
+
+        const auto out_fd = pkgi_create((_dest + '/' + file.path).c_str());
+        if (!out_fd)
+            throw formatEx<std::runtime_error>(
+                    "imposible abrir archivo {}", file.path);
+        BOOST_SCOPE_EXIT_ALL(&)
+        {
+            pkgi_close(out_fd);
+        };
+
+        uint64_t pos = 0;
+        while (pos < file.size)
+        {
+            const auto to_fill =
+                    std::min<uint64_t>(buffer.size(), file.size - pos);
+            uint64_t filled = 0;
+            while (filled < to_fill)
+            {
+                const auto readed = zip_fread(
+                        comp_fd, buffer.data() + filled, to_fill - filled);
+                if (readed <= 0)
+                    throw formatEx<std::runtime_error>(
+                            "imposible leer {} de {}:\n{}",
+                            file.path,
+                            _zip_file,
+                            zip_strerror(zip_fd));
+                filled += readed;
+            }
+            pkgi_write(out_fd, buffer.data(), filled);
+            pos += filled;
+        }
+    }
+};
+}
+
+void pkgi_extract_zip(const std::string& zip_file, const std::string& dest)
+{
+    std::vector<ZipEntry> files;
+    std::vector<std::string> directories;
+    plan_extraction(zip_file, files, directories);
+
+    for (const auto& directory : directories)
+    {
+        LOGF("creando directorio {}", directory);
+        pkgi_mkdirs((dest + '/' + directory).c_str());
+    }
+
+    ZipExtractor(zip_file, dest, files).run();
+}
+
+namespace
+{
+constexpr uint32_t LOCAL_HEADER_SIGNATURE = 0x04034b50;
+constexpr uint32_t DESCRIPTOR_SIGNATURE = 0x08074b50;
+constexpr uint16_t FLAG_ENCRYPTED = 1 << 0;
+// sizes and crc are in a descriptor after the data
+constexpr uint16_t FLAG_DESCRIPTOR = 1 << 3;
+constexpr uint16_t METHOD_STORE = 0;
+constexpr uint16_t METHOD_DEFLATE = 8;
+constexpr uint16_t ZIP64_EXTRA_ID = 0x0001;
+
+uint16_t le16(const uint8_t* p)
+{
+    return p[0] | p[1] << 8;
+}
+
+uint32_t le32(const uint8_t* p)
+{
+    return le16(p) | static_cast<uint32_t>(le16(p + 2)) << 16;
+}
+}
+
+ZipStreamExtractor::ZipStreamExtractor(const std::string& dest)
+    : _dest(dest), _buffer(WRITE_SIZE)
+{
+}
+
+ZipStreamExtractor::~ZipStreamExtractor()
+{
+    if (_out)
+        pkgi_close(_out);
+    if (_stream_init)
+        inflateEnd(&_stream);
+}
+
+void ZipStreamExtractor::feed(const uint8_t* data, size_t size)
+{
+    const uint8_t* const end = data + size;
+    while (data < end && _state != State::End)
+    {
+        const auto next = _state == State::Data ? extract(data, end)
+                                                 : read_record(data, end);
+        _offset += next - data;
+        data = next;
+
+        // between two entries
+        if (_state == State::Signature && _record.empty())
+            _entry_offset = _offset;
+    }
+}
+
+void ZipStreamExtractor::rewind()
+{
+    // the file being extracted is created again from its start
+    if (_out)
+        pkgi_close(_out);
+    _out = nullptr;
+    _buffered = 0;
+
+    _offset = _entry_offset;
+    expect(State::Signature, 4);
+}
+
+void ZipStreamExtractor::finish()
+{
+    // the central directory follows the last entry
+    if (_state != State::End)
+        throw std::runtime_error("zip truncado");
+}
+
+void ZipStreamExtractor::expect(State state, size_t size)
+{
+    _state = state;
+    _record.clear();
+    _record_size = size;
+}
+
+const uint8_t* ZipStreamExtractor::read_record(
+        const uint8_t* data, const uint8_t* end)
+{
+    const auto size =
+            std::min<size_t>(_record_size - _record.size(), end - data);
+    _record.insert(_record.end(), data, data + size);
+    if (_record.size() == _record_size)
+        parse_record();
+    return data + size;
+}
+
+void ZipStreamExtractor::parse_record()
+{
+    const uint8_t* const record = _record.data();
+    switch (_state)
+    {
+    case State::Signature:
+        if (le32(record) == LOCAL_HEADER_SIGNATURE)
+            expect(State::Header, 26);
+        else if (_entries == 0)
+            throw ZipStreamUnsupported("cabecera de zip no reconocida");
+        else
+            // central directory, nothing else is needed
+            expect(State::End, 0);
+        break;
+    case State::Header:
+    {
+        _flags = le16(record + 2);
+        _method = le16(record + 4);
+        _expected_crc = le32(record + 10);
+        const auto comp_size = le32(record + 14);
+        const auto size = le32(record + 18);
+        _name_size = le16(record + 22);
+        const auto extra_size = le16(record + 24);
+
+        if (_flags & FLAG_ENCRYPTED)
+            throw ZipStreamUnsupported("zip encriptado");
+        if (_method != METHOD_STORE && _method != METHOD_DEFLATE)
+            throw ZipStreamUnsupported(fmt::format(
+                    "metodo de compresion {} no soportado", _method));
+        if (comp_size == UINT32_MAX || size == UINT32_MAX)
+            throw ZipStreamUnsupported("zip64 no soportado");
+        if (_method == METHOD_STORE && (_flags & FLAG_DESCRIPTOR))
+            throw ZipStreamUnsupported("entrada sin tamaño");
+        if (_name_size == 0)
+            throw ZipStreamUnsupported("entrada sin nombre");
+
+        _remaining = comp_size;
+        expect(State::Name, _name_size + extra_size);
+        break;
+    }
+    case State::Name:
+        for (size_t pos = _name_size; pos + 4 <= _record.size();
+             pos += 4 + le16(record + pos + 2))
+            if (le16(record + pos) == ZIP64_EXTRA_ID)
+                throw ZipStreamUnsupported("zip64 no soportado");
+        _path.assign(reinterpret_cast<const char*>(record), _name_size);
+        start_entry();
+        break;
+    case State::Descriptor:
+        // the signature of the descriptor is optional
+        if (le32(record) == DESCRIPTOR_SIGNATURE)
+        {
+            check_crc(le32(record + 4));
+            expect(State::DescriptorSizes, 4);
+        }
+        else
+        {
+            check_crc(le32(record));
+            expect(State::Signature, 4);
+        }
+        break;
+    case State::DescriptorSizes:
+        expect(State::Signature, 4);
+        break;
+    case State::Data:
+    case State::End:
+        break;
+    }
+}
+
+void ZipStreamExtractor::make_directory(const std::string& path)
+{
+    if (!_directories.insert(path).second)
+        return;
+    LOGF("creando directorio {}", path);
+    pkgi_mkdirs((_dest + '/' + path).c_str());
+}
+
+void ZipStreamExtractor::start_entry()
+{
+    ++_entries;
+
+    // directories have no file, but may have empty compressed data
+    if (_path[_path.size() - 1] == '/')
+        make_directory(_path.substr(0, _path.size() - 1));
+    else
+    {
+        const auto slash = _path.rfind('/');
+        if (slash != std::string::npos)
+            make_directory(_path.substr(0, slash));
+
+        LOGF("descomprimiendo archivo {}", _path);
+        _out = pkgi_create(_dest + '/' + _path);
+        if (!_out)
+            throw formatEx<std::runtime_error>(
+                    "imposible abrir archivo {}", _path);
+    }
+
+    _crc = crc32(0, nullptr, 0);
+    if (_method == METHOD_DEFLATE)
+    {
+        const auto err = _stream_init ? inflateReset(&_stream)
+                                      : inflateInit2(&_stream, -MAX_WBITS);
+        if (err != Z_OK)
+            throw formatEx<std::runtime_error>(
+                    "fallo al iniciar zlib: {}", err);
+        _stream_init = true;
+    }
+
+    _state = State::Data;
+    if (_method == METHOD_STORE && _remaining == 0)
+        finish_entry();
+}
+
+const uint8_t* ZipStreamExtractor::extract(
+        const uint8_t* data, const uint8_t* end)
+{
+    if (_method == METHOD_STORE)
+    {
+        const auto size = std::min<uint64_t>(_remaining, end - data);
+        output(data, size);
+        _remaining -= size;
+        if (_remaining == 0)
+            finish_entry();
+        return data + size;
+    }
+
+    // inflate straight into the write buffer
+    _stream.next_in = const_cast<uint8_t*>(data);
+    _stream.avail_in = end - data;
+    for (;;)
+    {
+        const auto space = _buffer.size() - _buffered;
+        _stream.next_out = _buffer.data() + _buffered;
+        _stream.avail_out = space;
+        const auto err = inflate(&_stream, Z_NO_FLUSH);
+        if (err != Z_OK && err != Z_STREAM_END && err != Z_BUF_ERROR)
+            throw formatEx<std::runtime_error>(
+                    "zip corrupto en {}: {}",
+                    _path,
+                    _stream.msg ? _stream.msg : "error de zlib");
+
+        const auto produced = space - _stream.avail_out;
+        _crc = crc32(_crc, _buffer.data() + _buffered, produced);
+        _buffered += produced;
+        if (_buffered == _buffer.size())
+            flush();
+
+        if (err == Z_STREAM_END)
+        {
+            const auto next = end - _stream.avail_in;
+            finish_entry();
+            return next;
+        }
+        if (_stream.avail_in == 0)
+            return end;
+        if (err == Z_BUF_ERROR)
+            throw formatEx<std::runtime_error>("zip corrupto en {}", _path);
+    }
+}
+
+void ZipStreamExtractor::output(const uint8_t* data, size_t size)
+{
+    _crc = crc32(_crc, data, size);
+    while (size > 0)
+    {
+        const auto part = std::min(size, _buffer.size() - _buffered);
+        std::copy(data, data + part, _buffer.data() + _buffered);
+        _buffered += part;
+        data += part;
+        size -= part;
+        if (_buffered == _buffer.size())
+            flush();
+    }
+}
+
+void ZipStreamExtractor::flush()
+{
+    if (_buffered == 0)
+        return;
+    if (!_out)
+        throw formatEx<std::runtime_error>("directorio con datos: {}", _path);
+    pkgi_write(_out, _buffer.data(), _buffered);
+    _written += _buffered;
+    _buffered = 0;
+}
+
+void ZipStreamExtractor::finish_entry()
+{
+    flush();
+    if (_out)
+        pkgi_close(_out);
+    _out = nullptr;
 
-            static constexpr auto READ_SIZE = 1 * 1024 * 1024;
-            std::vector<uint8_t> buffer(READ_SIZE);
+    if (_flags & FLAG_DESCRIPTOR)
+        expect(State::Descriptor, 12);
+    else
+    {
+        check_crc(_expected_crc);
+        expect(State::Signature, 4);
+    }
+}
+
+void ZipStreamExtractor::check_crc(uint32_t crc)
+{
+    if (crc != _crc)
+        throw formatEx<std::runtime_error>("CRC incorrecto en {}", _path);
+}
+
+void pkgi_extract_zip_stream(
+        const std::function<std::unique_ptr<Http>()>& http_factory,
+        const std::string& url,
+        const std::string& dest,
+        const std::function<void(uint64_t, uint64_t)>& progress,
+        const std::function<bool()>& is_canceled)
+{
+    LOGF("descargando y descomprimiendo {}", url);
 
-            uint64_t pos = 0;
-            while (pos < stat.size)
+    ZipStreamExtractor extractor(dest);
+    std::vector<uint8_t> chunk(64 * 1024);
+    // of the whole zip, as answered to the first request
+    int64_t length = -1;
+    std::string etag;
+    unsigned failures = 0;
+    uint64_t failed_offset = 0;
+    for (;;)
+    {
+        uint64_t offset = extractor.resume_offset();
+        try
+        {
+            const auto http = http_factory();
+            http->start(url, offset);
+            const auto http_length = http->get_length();
+            if (offset == 0)
+            {
+                length = http_length;
+                etag = http->get_response_header("ETag");
+            }
+            else if (
+                    http_length + static_cast<int64_t>(offset) != length ||
+                    http->get_response_header("ETag") != etag)
+                throw std::runtime_error(
+                        "el servidor no permite reanudar la descarga o el "
+                        "archivo cambio");
+
+            while (!extractor.done())
             {
-                const auto to_read =
-                        std::min<uint64_t>(buffer.size(), stat.size - pos);
-                const auto readed = zip_fread(comp_fd, buffer.data(), to_read);
-                pkgi_write(out_fd, buffer.data(), readed);
-                pos += readed;
+                if (is_canceled && is_canceled())
+                    throw std::runtime_error("descarga cancelada");
+
+                const auto read = http->read(chunk.data(), chunk.size());
+                if (read <= 0)
+                    break;
+                extractor.feed(chunk.data(), read);
+                offset += read;
+
+                if (progress)
+                    progress(offset, length);
             }
+            if (!extractor.done() && length >= 0 &&
+                offset < static_cast<uint64_t>(length))
+                throw HttpError("conexion HTTP cerrada");
+            extractor.finish();
+            break;
+        }
+        catch (const HttpError& e)
+        {
+            // without a length, a restart couldn't be checked
+            if (length < 0)
+                throw;
+            if (extractor.resume_offset() != failed_offset)
+                failures = 0;
+            if (++failures > STREAM_RETRIES)
+                throw;
+            failed_offset = extractor.resume_offset();
+            LOGF("{}, reanudando desde {}", e.what(), failed_offset);
+            extractor.rewind();
         }
     }
+
+    LOGF("{} bytes descargados, {} bytes extraidos",
+         length,
+         extractor.written());
 }
@@ -1,5 +1,129 @@
 #pragma once
 
+#include "http.hpp"
+
+#include <zlib.h>
+
+#include <functional>
+#include <memory>
+#include <set>
+#include <stdexcept>
 #include <string>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
 
 void pkgi_extract_zip(const std::string& zip_file, const std::string& dest);
+
+// Thrown by ZipStreamExtractor for zips that can only be extracted with their
+// central directory, from a file given to pkgi_extract_zip
+class ZipStreamUnsupported : public std::runtime_error
+{
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// Extracts a zip given in chunks of any size, as it is downloaded, from the
+// local header in front of each entry. The central directory at the end of
+// the zip is not needed. Entries that are encrypted, zip64, neither stored
+// nor deflated, or stored with their size after their data are unsupported.
+class ZipStreamExtractor
+{
+public:
+    ZipStreamExtractor(const std::string& dest);
+    ~ZipStreamExtractor();
+
+    ZipStreamExtractor(const ZipStreamExtractor&) = delete;
+    ZipStreamExtractor& operator=(const ZipStreamExtractor&) = delete;
+
+    void feed(const uint8_t* data, size_t size);
+    // throws if the zip was truncated
+    void finish();
+
+    // size of the files extracted so far
+    uint64_t written() const
+    {
+        return _written;
+    }
+
+    // true once the central directory is reached, the rest of the zip is
+    // not needed
+    bool done() const
+    {
+        return _state == State::End;
+    }
+
+    // offset in the zip of the first entry not fully extracted yet
+    uint64_t resume_offset() const
+    {
+        return _entry_offset;
+    }
+    // drops what was fed after resume_offset(), the data must then be fed
+    // again from there
+    void rewind();
+
+private:
+    enum class State
+    {
+        Signature,
+        Header,
+        Name,
+        Data,
+        Descriptor,
+        DescriptorSizes,
+        End,
+    };
+
+    std::string _dest;
+    State _state = State::Signature;
+    // bytes of the zip fed so far
+    uint64_t _offset = 0;
+    uint64_t _entry_offset = 0;
+    // the record being read and the size it must reach
+    std::vector<uint8_t> _record;
+    size_t _record_size = 4;
+
+    // current entry
+    std::string _path;
+    uint16_t _flags = 0;
+    uint16_t _method = 0;
+    size_t _name_size = 0;
+    uint32_t _expected_crc = 0;
+    uint32_t _crc = 0;
+    // compressed bytes left, for stored entries
+    uint64_t _remaining = 0;
+    void* _out = nullptr;
+    z_stream _stream{};
+    bool _stream_init = false;
+
+    // file data is only written in full buffers
+    std::vector<uint8_t> _buffer;
+    size_t _buffered = 0;
+    std::set<std::string> _directories;
+    uint64_t _entries = 0;
+    uint64_t _written = 0;
+
+    const uint8_t* read_record(const uint8_t* data, const uint8_t* end);
+    void parse_record();
+    void start_entry();
+    const uint8_t* extract(const uint8_t* data, const uint8_t* end);
+    void output(const uint8_t* data, size_t size);
+    void flush();
+    void finish_entry();
+    void check_crc(uint32_t crc);
+    void make_directory(const std::string& path);
+    void expect(State state, size_t size);
+};
+
+// Downloads url and extracts it into dest as it arrives, without saving the
+// zip. A dropped connection is started again with a new Http from the first
+// entry not extracted yet. Throws ZipStreamUnsupported, possibly after some
+// files were written, for zips that have to be downloaded and given to
+// pkgi_extract_zip.
+void pkgi_extract_zip_stream(
+        const std::function<std::unique_ptr<Http>()>& http_factory,
+        const std::string& url,
+        const std::string& dest,
+        const std::function<void(uint64_t, uint64_t)>& progress = {},
+        const std::function<bool()>& is_canceled = {});
@@ -10,36 +10,119 @@
 #include <boost/scope_exit.hpp>
 
 #include <cereal/archives/binary.hpp>
+#include <cereal/types/string.hpp>
 
 #include <fstream>
 
 #include <cstddef>
 
-FileDownload::FileDownload(std::unique_ptr<Http> http) : _http(std::move(http))
+namespace
+{
+constexpr auto SAVE_PERIOD = 64 * 1024;
+// the resume file is only rewritten once this much more has been written
+constexpr uint64_t RESUME_PERIOD = 1024 * 1024;
+}
+
+FileDownload::FileDownload(std::unique_ptr<Http> http)
+    : _http(std::move(http)), buffer(SAVE_PERIOD)
 {
 }
 
 void FileDownload::update_progress()
 {
-    update_progress_cb(download_offset, download_size);
+    if (update_progress_cb)
+        update_progress_cb(download_offset, download_size);
+}
+
+bool FileDownload::deserialize_state()
+{
+    const auto state_file = fmt::format("{}.resume", root);
+
+    if (!pkgi_file_exists(state_file.c_str()))
+        return false;
+
+    try
+    {
+        LOG("arch. para reanudar descarga encontrado");
+
+        std::ifstream ss(state_file);
+        cereal::BinaryInputArchive iarchive(ss);
+
+        uint8_t version;
+        iarchive(version);
+        if (version != 1)
+            throw std::runtime_error(
+                    "version de datos para reanudar invalidos");
+
+        std::string url;
+        iarchive(url);
+        iarchive(download_offset, download_size);
+        iarchive(download_etag);
+
+        if (url != download_url)
+            throw std::runtime_error("la URL de la descarga cambio");
+        if (download_offset > download_size ||
+            pkgi_get_size(root.c_str()) < static_cast<int64_t>(download_offset))
+            throw std::runtime_error("archivo descargado incompleto");
+
+        LOGF("reanudando descarga desde {}/{}", download_offset, download_size);
+        return true;
+    }
+    catch (const std::exception& e)
+    {
+        LOGF("imposible reanudar descarga: {}", e.what());
+        pkgi_rm(state_file.c_str());
+        download_offset = 0;
+        download_size = 0;
+        download_etag.clear();
+        return false;
+    }
+}
+
+void FileDownload::serialize_state() const
+{
+    std::ofstream ss(
+            fmt::format("{}.resume", root), std::ios::out | std::ios::trunc);
+    cereal::BinaryOutputArchive oarchive(ss);
+
+    oarchive(static_cast<uint8_t>(1));
+
+    oarchive(download_url);
+    oarchive(download_offset, download_size);
+    oarchive(download_etag);
 }
 
 void FileDownload::start_download()
 {
-    LOGF("solicitando {}", download_url);
-    _http->start(download_url, 0);
+    LOGF("solicitando {} @ {}", download_url, download_offset);
+    _http->start(download_url, download_offset);
 
     const auto http_length = _http->get_length();
     if (http_length < 0)
         throw DownloadError("Longitud de respuesta HHTP desconocida");
 
-    download_size = http_length;
-    LOGF("longitud de respuesta http = {}", download_size);
+    const auto etag = _http->get_response_header("ETag");
+    if (download_offset != 0 &&
+        (download_size != download_offset + http_length ||
+         etag != download_etag))
+    {
+        // the file on the server is not the one we started with, or the
+        // server ignored the range, the next try starts over
+        pkgi_rm(fmt::format("{}.resume", root).c_str());
+        throw DownloadError(
+                "el archivo cambio en el servidor, descargalo de nuevo");
+    }
+
+    download_size = download_offset + http_length;
+    download_etag = etag;
+    LOGF("longitud de respuesta http = {}, tamaño total = {}",
+         http_length,
+         download_size);
 }
 
 void FileDownload::download_data(uint32_t size)
 {
-    if (is_canceled())
+    if (is_canceled && is_canceled())
         throw std::runtime_error("descarga cancelada");
 
     if (size == 0)
@@ -47,7 +130,6 @@ void FileDownload::download_data(uint32_t size)
 
     update_progress();
 
-    std::vector<uint8_t> buffer(size);
     {
         size_t pos = 0;
         while (pos < size)
@@ -59,35 +141,68 @@ void FileDownload::download_data(uint32_t size)
         }
     }
 
-    download_offset += size;
+    pkgi_write(item_file, buffer.data(), size);
 
-    pkgi_write(item_file, buffer.data(), buffer.size());
+    download_offset += size;
 }
 
 void FileDownload::download_file()
 {
     LOG("descargando arch. encriptados");
 
-    LOGF("creando archivo {}", root);
-    item_file = pkgi_create(root.c_str());
-    if (!item_file)
-        throw formatEx<DownloadError>("imposible crear archivo {}", root);
+    if (deserialize_state())
+    {
+        item_file = pkgi_openrw(root.c_str());
+        if (!item_file)
+            throw formatEx<DownloadError>("imposible abrir archivo {}", root);
+        if (pkgi_seek(item_file, download_offset) < 0)
+        {
+            pkgi_close(item_file);
+            pkgi_rm(fmt::format("{}.resume", root).c_str());
+            throw DownloadError("fallo al buscar para reanudar");
+        }
+    }
+    else
+    {
+        LOGF("creando archivo {}", root);
+        item_file = pkgi_create(root.c_str());
+        if (!item_file)
+            throw formatEx<DownloadError>("imposible crear archivo {}", root);
+    }
 
     BOOST_SCOPE_EXIT_ALL(&)
     {
         pkgi_close(item_file);
     };
 
+    resume_offset = download_offset;
     start_download();
 
-    static constexpr auto SAVE_PERIOD = 64 * 1024;
-
-    while (download_offset < download_size)
+    uint64_t saved_offset = download_offset;
+    try
+    {
+        while (download_offset < download_size)
+        {
+            const uint32_t read = (uint32_t)min64(
+                    SAVE_PERIOD, download_size - download_offset);
+            download_data(read);
+
+            if (download_offset - saved_offset >= RESUME_PERIOD)
+            {
+                serialize_state();
+                saved_offset = download_offset;
+            }
+        }
+    }
+    catch (...)
     {
-        const uint32_t read =
-                (uint32_t)min64(SAVE_PERIOD, download_size - download_offset);
-        download_data(read);
+        // resume from the last byte written rather than the last period
+        if (download_offset != saved_offset)
+            serialize_state();
+        throw;
     }
+
+    pkgi_rm(fmt::format("{}.resume", root).c_str());
 }
 
 void FileDownload::download(
@@ -101,6 +216,7 @@ void FileDownload::download(
     download_size = 0;
     download_offset = 0;
     download_url = url;
+    download_etag.clear();
 
     download_file();
 }
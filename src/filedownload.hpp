@@ -4,11 +4,15 @@
 #include <memory>
 #include <stdexcept>
 #include <string>
+#include <vector>
 
 #include <cstdint>
 
 #include "http.hpp"
 
+// Downloads a file to {partition}pkgj/{titleid}-comp.ppk. Progress is saved
+// in a .resume file next to it, so that a download that failed continues from
+// the last byte written the next time it is started.
 class FileDownload
 {
 public:
@@ -23,18 +27,30 @@ public:
             const std::string& titleid,
             const std::string& url);
 
+    // offset the last download() started from, 0 unless it resumed
+    uint64_t resumed_offset() const
+    {
+        return resume_offset;
+    }
+
 private:
     std::string root;
 
     std::unique_ptr<Http> _http;
     uint64_t download_size;
     uint64_t download_offset;
+    uint64_t resume_offset = 0;
     std::string download_url;
+    std::string download_etag;
 
     void* item_file;
+    std::vector<uint8_t> buffer;
 
     void update_progress();
 
+    bool deserialize_state();
+    void serialize_state() const;
+
     void start_download();
     void download_data(uint32_t size);
     void download_file();
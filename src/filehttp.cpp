@@ -2,6 +2,12 @@
 
 #include "log.hpp"
 
+#include <fmt/format.h>
+
+#include <sys/stat.h>
+
+#include <ctime>
+
 FileHttp::FileHttp(const std::string& path) : override_path(path)
 {
 }
@@ -9,12 +15,44 @@ FileHttp::FileHttp(const std::string& path) : override_path(path)
 void FileHttp::start(const std::string& url, uint64_t offset)
 {
     LOGF("Descarga falsa {}", url);
-    f.open(override_path.empty() ? url : override_path);
+    const auto path = override_path.empty() ? url : override_path;
+
+    response_headers.clear();
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0)
+    {
+        char date[64];
+        strftime(
+                date,
+                sizeof(date),
+                "%a, %d %b %Y %H:%M:%S GMT",
+                gmtime(&st.st_mtime));
+        response_headers["ETag"] = fmt::format(
+                "\"{:x}-{:x}-{:x}\"",
+                st.st_size,
+                st.st_mtim.tv_sec,
+                st.st_mtim.tv_nsec);
+        response_headers["Last-Modified"] = date;
+    }
+
+    const auto etag = request_headers.find("If-None-Match");
+    const auto date = request_headers.find("If-Modified-Since");
+    if (etag != request_headers.end())
+        not_modified = etag->second == response_headers["ETag"];
+    else if (date != request_headers.end())
+        not_modified = date->second == response_headers["Last-Modified"];
+    request_headers.clear();
+    if (not_modified)
+        return;
+
+    f.open(path);
     f.seekg(offset, std::ios::beg);
 }
 
 int64_t FileHttp::read(uint8_t* buffer, uint64_t size)
 {
+    if (not_modified)
+        return 0;
     f.read(reinterpret_cast<char*>(buffer), size);
     return f.gcount();
 }
@@ -25,19 +63,34 @@ void FileHttp::abort()
 
 int FileHttp::get_status()
 {
-    return 200;
+    return not_modified ? 304 : 200;
 }
 
 int64_t FileHttp::get_length()
 {
+    if (not_modified)
+        return 0;
     const uint64_t pos = f.tellg();
     f.seekg(0, std::ios::end);
     const uint64_t size = f.tellg();
     f.seekg(pos, std::ios::beg);
-    return size;
+    // like the Content-Length of a range request, what is left to read
+    return size - pos;
+}
+
+void FileHttp::add_request_header(
+        const std::string& name, const std::string& value)
+{
+    request_headers[name] = value;
+}
+
+std::string FileHttp::get_response_header(const std::string& name)
+{
+    const auto it = response_headers.find(name);
+    return it == response_headers.end() ? std::string() : it->second;
 }
 
 FileHttp::operator bool() const
 {
-    return f.is_open();
+    return f.is_open() || not_modified;
 }
@@ -3,6 +3,7 @@
 #include "http.hpp"
 
 #include <fstream>
+#include <map>
 #include <string>
 
 class FileHttp : public Http
@@ -17,9 +18,18 @@ public:
     int get_status() override;
     int64_t get_length() override;
 
+    void add_request_header(
+            const std::string& name, const std::string& value) override;
+    std::string get_response_header(const std::string& name) override;
+
     explicit operator bool() const override;
 
 private:
     std::string override_path;
     std::ifstream f;
+
+    // validators of the file, answers conditional requests like a server
+    std::map<std::string, std::string> request_headers;
+    std::map<std::string, std::string> response_headers;
+    bool not_modified = false;
 };
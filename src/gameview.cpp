@@ -27,7 +27,7 @@ GameView::GameView(
     , _item(item)
     , _base_comppack(base_comppack)
     , _patch_comppack(patch_comppack)
-    , _patch_info_fetcher(item->titleid)
+    , _patch_info_fetcher(std::string(item->titleid))
     , _image_fetcher(item)
 {
     refresh();
@@ -244,7 +244,7 @@ std::string GameView::get_min_system_version()
     if (patchInfo)
         return patchInfo->fw_version;
     else
-        return _item->fw_version;
+        return std::string(_item->fw_version);
 }
 
 void GameView::refresh()
@@ -252,8 +252,9 @@ void GameView::refresh()
     LOGF("refrescando gameview");
     _refood_present = pkgi_is_module_present("ref00d");
     _0syscall6_present = pkgi_is_module_present("0syscall6");
-    _game_version = pkgi_get_game_version(_item->titleid);
-    _comppack_versions = pkgi_get_comppack_versions(_item->titleid);
+    _game_version = pkgi_get_game_version(std::string(_item->titleid));
+    _comppack_versions =
+            pkgi_get_comppack_versions(std::string(_item->titleid));
 }
 
 
@@ -292,8 +293,8 @@ void GameView::start_download_comppack(bool patch)
 
     _downloader->add(DownloadItem{
             patch ? CompPackPatch : CompPackBase,
-            _item->name,
-            _item->titleid,
+            std::string(_item->name),
+            std::string(_item->titleid),
             _config->comppack_url + entry->path,
             std::vector<uint8_t>{},
             std::vector<uint8_t>{},
@@ -0,0 +1,134 @@
+#include "gzip.hpp"
+
+#include "log.hpp"
+
+#include <stdexcept>
+
+namespace
+{
+constexpr auto ChunkSize = 64 * 1024;
+
+// windowBits to detect gzip and zlib headers, or to write a gzip header
+constexpr auto AutoHeader = 15 + 32;
+constexpr auto GzipHeader = 15 + 16;
+
+const char* zlib_error(const z_stream& stream, int err)
+{
+    return stream.msg ? stream.msg : zError(err);
+}
+}
+
+bool pkgi_is_gzip(const uint8_t* data, size_t size)
+{
+    // a single byte is enough to tell, 0x1f can't start a text file
+    return size >= 1 && data[0] == 0x1f && (size < 2 || data[1] == 0x8b);
+}
+
+bool pkgi_is_compressed_encoding(std::string_view content_encoding)
+{
+    return content_encoding == "gzip" || content_encoding == "x-gzip" ||
+           content_encoding == "deflate";
+}
+
+Inflater::Inflater() : _out(ChunkSize)
+{
+    const auto err = inflateInit2(&_stream, AutoHeader);
+    if (err != Z_OK)
+        throw formatEx<std::runtime_error>(
+                "fallo al iniciar zlib: {}", zlib_error(_stream, err));
+}
+
+Inflater::~Inflater()
+{
+    inflateEnd(&_stream);
+}
+
+void Inflater::feed(const uint8_t* data, size_t size, const Output& out)
+{
+    _stream.next_in = const_cast<uint8_t*>(data);
+    _stream.avail_in = size;
+
+    // output may remain in zlib when the output buffer is full
+    while (_stream.avail_in > 0 || _stream.avail_out == 0)
+    {
+        // gzip files may be made of several members
+        if (_stream_end)
+        {
+            if (_stream.avail_in == 0)
+                break;
+            inflateReset(&_stream);
+            _stream_end = false;
+        }
+
+        _stream.next_out = _out.data();
+        _stream.avail_out = _out.size();
+
+        const auto err = inflate(&_stream, Z_NO_FLUSH);
+        if (err == Z_STREAM_END)
+            _stream_end = true;
+        else if (err != Z_OK && err != Z_BUF_ERROR)
+            throw formatEx<std::runtime_error>(
+                    "datos comprimidos invalidos: {}",
+                    zlib_error(_stream, err));
+
+        const auto produced = _out.size() - _stream.avail_out;
+        if (produced > 0)
+            out(_out.data(), produced);
+        else if (err == Z_BUF_ERROR)
+            break;
+    }
+}
+
+void Inflater::finish()
+{
+    if (!_stream_end)
+        throw std::runtime_error("datos comprimidos truncados");
+}
+
+Deflater::Deflater(int level) : _out(ChunkSize)
+{
+    const auto err = deflateInit2(
+            &_stream, level, Z_DEFLATED, GzipHeader, 8, Z_DEFAULT_STRATEGY);
+    if (err != Z_OK)
+        throw formatEx<std::runtime_error>(
+                "fallo al iniciar zlib: {}", zlib_error(_stream, err));
+}
+
+Deflater::~Deflater()
+{
+    deflateEnd(&_stream);
+}
+
+void Deflater::feed(const uint8_t* data, size_t size, const Output& out)
+{
+    _stream.next_in = const_cast<uint8_t*>(data);
+    _stream.avail_in = size;
+    deflate(Z_NO_FLUSH, out);
+}
+
+void Deflater::finish(const Output& out)
+{
+    _stream.next_in = nullptr;
+    _stream.avail_in = 0;
+    deflate(Z_FINISH, out);
+}
+
+void Deflater::deflate(int flush, const Output& out)
+{
+    int err;
+    do
+    {
+        _stream.next_out = _out.data();
+        _stream.avail_out = _out.size();
+
+        err = ::deflate(&_stream, flush);
+        if (err == Z_STREAM_ERROR)
+            throw formatEx<std::runtime_error>(
+                    "fallo al comprimir: {}", zlib_error(_stream, err));
+
+        const auto produced = _out.size() - _stream.avail_out;
+        if (produced > 0)
+            out(_out.data(), produced);
+    } while (_stream.avail_out == 0 ||
+             (flush == Z_FINISH && err != Z_STREAM_END));
+}
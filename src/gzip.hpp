@@ -0,0 +1,60 @@
+#pragma once
+
+#include <zlib.h>
+
+#include <functional>
+#include <string_view>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+// true if data starts like a gzip file
+bool pkgi_is_gzip(const uint8_t* data, size_t size);
+// true for the Content-Encoding values Inflater can decode
+bool pkgi_is_compressed_encoding(std::string_view content_encoding);
+
+// Streaming decompression of gzip or zlib data given in chunks of any size.
+class Inflater
+{
+public:
+    // called with the decompressed data, which it may modify
+    using Output = std::function<void(uint8_t* data, size_t size)>;
+
+    Inflater();
+    ~Inflater();
+
+    Inflater(const Inflater&) = delete;
+    Inflater& operator=(const Inflater&) = delete;
+
+    void feed(const uint8_t* data, size_t size, const Output& out);
+    // throws if the compressed data was truncated
+    void finish();
+
+private:
+    z_stream _stream{};
+    bool _stream_end = false;
+    std::vector<uint8_t> _out;
+};
+
+// Streaming gzip compression.
+class Deflater
+{
+public:
+    using Output = Inflater::Output;
+
+    Deflater(int level = Z_BEST_SPEED);
+    ~Deflater();
+
+    Deflater(const Deflater&) = delete;
+    Deflater& operator=(const Deflater&) = delete;
+
+    void feed(const uint8_t* data, size_t size, const Output& out);
+    void finish(const Output& out);
+
+private:
+    z_stream _stream{};
+    std::vector<uint8_t> _out;
+
+    void deflate(int flush, const Output& out);
+};
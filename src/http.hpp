@@ -34,5 +34,17 @@ public:
     virtual int get_status() = 0;
     virtual int64_t get_length() = 0;
 
+    // sent with the next start, used for conditional requests (status 304
+    // when the resource didn't change)
+    virtual void add_request_header(
+            const std::string& /*name*/, const std::string& /*value*/)
+    {
+    }
+    // empty if the response has no such header
+    virtual std::string get_response_header(const std::string& /*name*/)
+    {
+        return {};
+    }
+
     virtual explicit operator bool() const = 0;
 };
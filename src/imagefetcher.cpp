@@ -19,7 +19,7 @@ std::string get_image_url(DbItem* item)
     {
         language = "zh";
         country_abbv = "HK";
-        const std::string region = item->content.substr(0, 6);
+        const auto region = item->content.substr(0, 6);
         if (item->name.find("CHN") != std::string::npos)
         {
             country_abbv = "CN";
@@ -1,7 +1,6 @@
 #include "install.hpp"
 
 #include "psx.hpp"
-#include "extractzip.hpp"
 #include "file.hpp"
 #include "log.hpp"
 #include "sfo.hpp"
@@ -13,16 +12,6 @@
 #include <psp2/io/fcntl.h>
 #include <psp2/promoterutil.h>
 
-std::vector<std::string> pkgi_get_installed_games()
-{
-    return pkgi_list_dir_contents("ux0:app");
-}
-
-std::vector<std::string> pkgi_get_installed_themes()
-{
-    return pkgi_list_dir_contents("ux0:theme");
-}
-
 namespace
 {
 std::string pkgi_extract_package_version(const std::string& package)
@@ -45,44 +34,6 @@ std::string pkgi_get_game_version(const std::string& titleid)
     return "";
 }
 
-bool pkgi_dlc_is_installed(const char* content)
-{
-    return pkgi_file_exists(
-            fmt::format("ux0:addcont/{:.9}/{:.16}", content + 7, content + 20)
-                    .c_str());
-}
-
-bool pkgi_psm_is_installed(const char* titleid)
-{
-    return pkgi_file_exists(fmt::format("ux0:psm/{}", titleid).c_str());
-}
-
-bool pkgi_psp_is_installed(const char* psppartition, const char* content)
-{
-    return pkgi_file_exists(
-                   fmt::format(
-                           "{}pspemu/ISO/{:.9}.iso", psppartition, content + 7)
-                           .c_str()) ||
-           pkgi_file_exists(fmt::format(
-                                    "{}pspemu/PSP/GAME/{:.9}/EBOOT.PBP",
-                                    psppartition,
-                                    content + 7)
-                                    .c_str());
-}
-
-bool pkgi_psx_is_installed(const char* psppartition, const char* content)
-{
-    bool game_exist = pkgi_file_exists(
-            fmt::format("{}pspemu/PSP/GAME/{:.9}", psppartition, content + 7)
-                    .c_str());
-    
-    if(!game_exist) {
-        game_exist = pkgi_is_psx_game_installed_titleid(std::string(content + 7, 9));
-    }
-    
-    return game_exist;
-}
-
 void pkgi_install(const char* contentid)
 {
     char path[128];
@@ -114,24 +65,27 @@ void pkgi_install_update(const std::string& titleid)
 }
 
 void pkgi_install_comppack(
-        const std::string& titleid, bool patch, const std::string& version)
+        const std::string& titleid,
+        bool patch,
+        const std::string& version,
+        const std::function<void(const std::string& dest)>& extract)
 {
-    const auto src = fmt::format("ux0:pkgj/{}-comp.ppk", titleid);
     const auto dest = fmt::format("ux0:rePatch/{}", titleid);
+    const auto version_file = fmt::format(
+            "{}/{}_comppack_version", dest, patch ? "patch" : "base");
 
+    // an extraction that fails part way leaves the files of two versions
+    // mixed, the version is only written back once the pack is complete
     if (!patch)
         pkgi_rm((dest + "/patch_comppack_version").c_str());
+    pkgi_rm(version_file.c_str());
 
     pkgi_mkdirs(dest.c_str());
 
-    LOGF("instalando pack comp desde {} a {}", src, dest);
-    pkgi_extract_zip(src, dest);
+    LOGF("instalando pack comp en {}", dest);
+    extract(dest);
 
-    pkgi_save(
-            fmt::format(
-                    "{}/{}_comppack_version", dest, patch ? "patch" : "base"),
-            version.data(),
-            version.size());
+    pkgi_save(version_file, version.data(), version.size());
 }
 
 CompPackVersion pkgi_get_comppack_versions(const std::string& titleid)
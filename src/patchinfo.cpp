@@ -1,7 +1,15 @@
 #include "patchinfo.hpp"
 
+#include "file.hpp"
+#include "log.hpp"
 #include "sha256.hpp"
 
+#include <cereal/archives/binary.hpp>
+#include <cereal/types/string.hpp>
+
+#include <ctime>
+#include <fstream>
+
 namespace
 {
 constexpr uint8_t HMAC_KEY[32] = {
@@ -32,13 +40,9 @@ std::string get_link_for_title(const std::string& titleid)
     return link;
 }
 
-std::optional<std::vector<uint8_t>> download_data(
-        Http* http, const std::string& url)
+std::vector<uint8_t> read_data(Http* http)
 {
     std::vector<uint8_t> data;
-    http->start(url, 0);
-    if (http->get_status() == 404)
-        return std::nullopt;
     size_t pos = 0;
     while (true)
     {
@@ -53,6 +57,30 @@ std::optional<std::vector<uint8_t>> download_data(
     return data;
 }
 
+std::optional<std::vector<uint8_t>> download_data(
+        Http* http, const std::string& url)
+{
+    http->start(url, 0);
+    if (http->get_status() == 404)
+        return std::nullopt;
+    return read_data(http);
+}
+
+// Value of the first attr="..." at or after from
+std::string get_attribute(
+        const std::string& xml, const std::string& attr, size_t from)
+{
+    const auto start = xml.find(attr, from);
+    if (start == std::string::npos)
+        throw formatEx<std::runtime_error>(
+                "falta {} en el XML del parche", attr);
+    const auto begin = start + attr.size();
+    const auto end = xml.find('"', begin);
+    if (end == std::string::npos)
+        throw std::runtime_error("XML del parche truncado");
+    return xml.substr(begin, end - begin);
+}
+
 PatchInfo get_last_patch(const std::string& xml)
 {
     static constexpr char PackageStr[] = "<package";
@@ -62,31 +90,83 @@ PatchInfo get_last_patch(const std::string& xml)
     static constexpr char Psp2SystemVerStr[] = "psp2_system_ver=\"";
 
     const auto last_package = xml.rfind(PackageStr);
+    if (last_package == std::string::npos)
+        throw std::runtime_error("XML del parche sin paquetes");
     const auto last_hybrid_package = xml.find(HybridPackageStr, last_package);
-    const auto version =
-            xml.find(VersionStr, last_package) + sizeof(VersionStr) - 1;
-    const auto version_end = xml.find('"', version);
-    const auto fw_version = xml.find(Psp2SystemVerStr, last_package) +
-                            sizeof(Psp2SystemVerStr) - 1;
-    const auto fw_version_end = xml.find('"', fw_version);
+    const auto version = get_attribute(xml, VersionStr, last_package);
+    const auto fw_version =
+            get_attribute(xml, Psp2SystemVerStr, last_package);
     const auto package_of_interest = last_hybrid_package == std::string::npos
                                              ? last_package
                                              : last_hybrid_package;
-    const auto url = xml.find(UrlStr, package_of_interest) + sizeof(UrlStr) - 1;
-    const auto url_end = xml.find('"', url);
+    const auto url = get_attribute(xml, UrlStr, package_of_interest);
 
-    const auto fw_version_int =
-            std::stoi(xml.substr(fw_version, fw_version_end - fw_version));
+    const auto fw_version_int = std::stoi(fw_version);
 
     return PatchInfo{
-            xml.substr(version, version_end - version),
+            version,
             fmt::format(
                     "{:x}.{:02x}",
                     fw_version_int >> 24,
                     (fw_version_int >> 16) & 0xff),
-            xml.substr(url, url_end - url),
+            url,
     };
 }
+
+// XML of a title as last received, empty if the title has no patch
+struct CacheEntry
+{
+    static constexpr uint8_t Version = 1;
+
+    int64_t fetched = 0;
+    std::string etag;
+    std::string last_modified;
+    std::string xml;
+};
+
+std::optional<CacheEntry> load_entry(const std::string& path)
+{
+    if (!pkgi_file_exists(path))
+        return std::nullopt;
+
+    try
+    {
+        std::ifstream ss(path, std::ios::binary);
+        cereal::BinaryInputArchive iarchive(ss);
+
+        uint8_t version;
+        iarchive(version);
+        if (version != CacheEntry::Version)
+            throw std::runtime_error("version de cache invalida");
+
+        CacheEntry entry;
+        iarchive(entry.fetched, entry.etag, entry.last_modified, entry.xml);
+        return entry;
+    }
+    catch (const std::exception& e)
+    {
+        LOGF("fallo al leer {}: {}", path, e.what());
+        return std::nullopt;
+    }
+}
+
+void save_entry(const std::string& path, const CacheEntry& entry)
+{
+    std::ofstream ss(path, std::ios::binary | std::ios::out | std::ios::trunc);
+    cereal::BinaryOutputArchive oarchive(ss);
+
+    oarchive(CacheEntry::Version);
+    oarchive(entry.fetched, entry.etag, entry.last_modified, entry.xml);
+    if (!ss)
+        throw formatEx<std::runtime_error>("fallo al escribir {}", path);
+}
+
+std::optional<PatchInfo> parse_entry(const CacheEntry& entry)
+{
+    if (entry.xml.empty())
+        return std::nullopt;
+    return get_last_patch(entry.xml);
+}
 }
 
 std::optional<PatchInfo> pkgi_download_patch_info(
@@ -101,3 +181,79 @@ std::optional<PatchInfo> pkgi_download_patch_info(
 
     return patch_info;
 }
+
+PatchInfoCache::PatchInfoCache(std::string dir, int64_t ttl)
+    : _dir(std::move(dir)), _ttl(ttl)
+{
+    pkgi_mkdirs(_dir.c_str());
+}
+
+std::optional<PatchInfo> PatchInfoCache::get(
+        Http* http, const std::string& titleid)
+{
+    const auto path = fmt::format("{}/{}-ver.cache", _dir, titleid);
+    const int64_t now = std::time(nullptr);
+
+    // an entry that doesn't parse is dropped and refetched from scratch
+    auto entry = load_entry(path);
+    std::optional<PatchInfo> cached;
+    if (entry)
+    {
+        try
+        {
+            cached = parse_entry(*entry);
+        }
+        catch (const std::exception& e)
+        {
+            LOGF("info del parche de {} en cache invalida: {}",
+                 titleid,
+                 e.what());
+            entry = std::nullopt;
+        }
+    }
+    if (entry && now >= entry->fetched && now - entry->fetched < _ttl)
+        return cached;
+
+    if (entry && !entry->etag.empty())
+        http->add_request_header("If-None-Match", entry->etag);
+    if (entry && !entry->last_modified.empty())
+        http->add_request_header("If-Modified-Since", entry->last_modified);
+
+    try
+    {
+        http->start(get_link_for_title(titleid), 0);
+
+        const auto status = http->get_status();
+        if (entry && status == 304)
+        {
+            LOGF("info del parche de {} sin cambios", titleid);
+            entry->fetched = now;
+            save_entry(path, *entry);
+            return cached;
+        }
+
+        if (status != 200 && status != 404)
+            throw formatEx<HttpError>("respuesta HTTP {}", status);
+
+        CacheEntry fresh;
+        fresh.fetched = now;
+        if (status == 200)
+        {
+            fresh.etag = http->get_response_header("ETag");
+            fresh.last_modified = http->get_response_header("Last-Modified");
+            const auto xml = read_data(http);
+            fresh.xml.assign(xml.begin(), xml.end());
+        }
+        // only cache what parses, a bad body must not outlive this call
+        const auto patch_info = parse_entry(fresh);
+        save_entry(path, fresh);
+        return patch_info;
+    }
+    catch (const std::exception& e)
+    {
+        if (!entry)
+            throw;
+        LOGF("usando info del parche de {} en cache: {}", titleid, e.what());
+        return cached;
+    }
+}
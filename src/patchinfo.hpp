@@ -5,6 +5,8 @@
 #include <optional>
 #include <string>
 
+#include <cstdint>
+
 struct PatchInfo
 {
     std::string version;
@@ -14,3 +16,22 @@ struct PatchInfo
 
 std::optional<PatchInfo> pkgi_download_patch_info(
         Http* http, const std::string& titleid);
+
+// Patch info XMLs of titles kept in dir, one file per title. An entry younger
+// than ttl seconds is used without a request, an older one is revalidated
+// with the ETag and Last-Modified the server sent with it, and is still used
+// if the server can't be reached. get can run concurrently for different
+// titles.
+class PatchInfoCache
+{
+public:
+    static constexpr int64_t DEFAULT_TTL = 24 * 60 * 60;
+
+    PatchInfoCache(std::string dir, int64_t ttl = DEFAULT_TTL);
+
+    std::optional<PatchInfo> get(Http* http, const std::string& titleid);
+
+private:
+    std::string _dir;
+    int64_t _ttl;
+};
@@ -46,8 +46,8 @@ void PatchInfoFetcher::do_request()
                 return;
             _http = std::make_unique<VitaHttp>();
         }
-        const auto patch_info =
-                pkgi_download_patch_info(_http.get(), _title_id);
+        PatchInfoCache cache("ux0:pkgj/patchinfo");
+        const auto patch_info = cache.get(_http.get(), _title_id);
         {
             std::lock_guard<Mutex> lock(_mutex);
             if (!patch_info)
@@ -15,6 +15,9 @@ extern "C"
 #include "imgui.hpp"
 #include "install.hpp"
 #include "menu.hpp"
+#include "presence.hpp"
+#include "psx.hpp"
+#include "refresher.hpp"
 #include "update.hpp"
 #include "utils.hpp"
 #include "vitahttp.hpp"
@@ -25,8 +28,11 @@ extern "C"
 
 #include <fmt/format.h>
 
+#include <boost/scope_exit.hpp>
+
+#include <algorithm>
 #include <memory>
-#include <set>
+#include <vector>
 
 #include <psp2common/npdrm.h>
 
@@ -65,16 +71,17 @@ char error_state[256];
 
 // used for multiple things actually
 Mutex refresh_mutex("refresh_mutex");
-std::string current_action;
+Refresher* refresher;
 std::unique_ptr<TitleDatabase> db;
 std::unique_ptr<CompPackDatabase> comppack_db_games;
 std::unique_ptr<CompPackDatabase> comppack_db_updates;
 
-std::set<std::string> installed_games;
-std::set<std::string> installed_themes;
+PresenceIndex presence;
 
 std::unique_ptr<GameView> gameview;
 bool need_refresh = true;
+// queue generation the presence of the rows was computed with
+uint32_t presence_queue_generation = 0;
 bool runtime_install_queued = false;
 std::string content_to_refresh;
 void pkgi_reload();
@@ -149,7 +156,7 @@ void configure_db(TitleDatabase* db, const char* search, const Config* config)
                 config->sort,
                 config->order,
                 search ? search : "",
-                installed_games);
+                presence.games());
     }
     catch (const std::exception& e)
     {
@@ -187,57 +194,79 @@ std::string const& pkgi_get_url_from_mode(Mode mode)
             fmt::format("modo desconocido: {}", static_cast<int>(mode)));
 }
 
+// modes the preload thread parses, picked before it starts so it reads
+// neither mode nor the config while the UI thread changes them
+static std::vector<Mode> preload_modes;
+
+// parses the lists of the other modes while the user browses the first one,
+// switching to them is then instant
+void pkgi_preload_thread(void)
+{
+    for (const auto preload_mode : preload_modes)
+        db->preload(preload_mode);
+    LOGF("listas precargadas, {} KB en memoria", db->memory_usage() / 1024);
+}
+
+// lists are downloaded concurrently, more workers than this doesn't speed
+// up the refresh on the vita
+static constexpr auto REFRESH_WORKERS = 3;
+
 void pkgi_refresh_thread(void)
 {
     LOG("empezando actualizacion");
     try
     {
-        auto mode_count = ModeCount + (config.comppack_url.empty() ? 0 : 2);
-
-        ScopeProcessLock lock;
+        std::vector<Refresher::Source> sources;
         for (int i = 0; i < ModeCount; ++i)
         {
             const auto mode = static_cast<Mode>(i);
             auto const url = pkgi_get_url_from_mode(mode);
             if (url.empty())
                 continue;
-            {
-                std::lock_guard<Mutex> lock(refresh_mutex);
-                current_action = fmt::format(
-                        "Refrescando {} [{}/{}]",
-                        pkgi_mode_to_string(mode),
-                        i + 1,
-                        mode_count);
-            }
-            auto const http = std::make_unique<VitaHttp>();
-            db->update(mode, http.get(), url);
+            sources.push_back(Refresher::Source{
+                    pkgi_mode_to_string(mode),
+                    [mode, url](Http* http, const auto& progress)
+                    { db->update(mode, http, url, progress); }});
         }
         if (!config.comppack_url.empty())
         {
-            {
-                std::lock_guard<Mutex> lock(refresh_mutex);
-                current_action = fmt::format(
-                        "Refrescando packs de compatibilidad [{}/{}]",
-                        mode_count - 1,
-                        mode_count);
-            }
-            {
-                auto const http = std::make_unique<VitaHttp>();
-                comppack_db_games->update(
-                        http.get(), config.comppack_url + "entries.txt");
-            }
-            {
-                std::lock_guard<Mutex> lock(refresh_mutex);
-                current_action = fmt::format(
-                        "Refrescando actual. de packs de compatibilidad [{}/{}]",
-                        mode_count,
-                        mode_count);
-            }
-            {
-                auto const http = std::make_unique<VitaHttp>();
-                comppack_db_updates->update(
-                        http.get(), config.comppack_url + "entries_patch.txt");
-            }
+            sources.push_back(Refresher::Source{
+                    "packs de compatibilidad",
+                    [](Http* http, const auto& progress)
+                    {
+                        comppack_db_games->update(
+                                http,
+                                config.comppack_url + "entries.txt",
+                                progress);
+                    }});
+            sources.push_back(Refresher::Source{
+                    "actual. de packs de compatibilidad",
+                    [](Http* http, const auto& progress)
+                    {
+                        comppack_db_updates->update(
+                                http,
+                                config.comppack_url + "entries_patch.txt",
+                                progress);
+                    }});
+        }
+
+        Refresher list_refresher(
+                [] { return std::make_unique<VitaHttp>(); },
+                std::move(sources),
+                REFRESH_WORKERS);
+        {
+            std::lock_guard<Mutex> lock(refresh_mutex);
+            refresher = &list_refresher;
+        }
+        BOOST_SCOPE_EXIT_ALL(&)
+        {
+            std::lock_guard<Mutex> lock(refresh_mutex);
+            refresher = nullptr;
+        };
+
+        {
+            ScopeProcessLock lock;
+            list_refresher.run();
         }
         first_item = 0;
         selected_item = 0;
@@ -264,32 +293,12 @@ const char* pkgi_get_mode_partition()
 
 void pkgi_refresh_installed_packages()
 {
-    auto games = pkgi_get_installed_games();
-    installed_games.clear();
-    installed_games.insert(
-            std::make_move_iterator(games.begin()),
-            std::make_move_iterator(games.end()));
-
-    auto themes = pkgi_get_installed_themes();
-    installed_themes.clear();
-    installed_themes.insert(
-            std::make_move_iterator(themes.begin()),
-            std::make_move_iterator(themes.end()));
+    presence.scan("ux0:", config.install_psp_psx_location);
 }
 
 bool pkgi_is_installed(const char* titleid)
 {
-    return installed_games.find(titleid) != installed_games.end();
-}
-
-bool pkgi_theme_is_installed(std::string contentid)
-{
-    if (contentid.size() < 19)
-        return false;
-
-    contentid.erase(16, 3);
-    contentid.erase(0, 7);
-    return installed_themes.find(contentid) != installed_themes.end();
+    return presence.game_installed(titleid);
 }
 
 void do_download(Downloader& downloader, DbItem* item) {
@@ -368,9 +377,21 @@ void pkgi_do_main(Downloader& downloader, pkgi_input* input)
             col_region + pkgi_text_width("USA") + PKGI_MAIN_COLUMN_PADDING;
     int col_name = col_installed + pkgi_text_width(PKGI_UTF8_INSTALLED) +
                    PKGI_MAIN_COLUMN_PADDING;
+    // games with a compatibility pack are marked before their name
+    const int col_comppack = col_name;
+    if (mode == ModeGames)
+        col_name += pkgi_text_width(PKGI_UTF8_COMPPACK) +
+                    PKGI_MAIN_COLUMN_PADDING;
 
     uint32_t db_count = db->count();
 
+    // rows show whether they are queued
+    if (downloader.queue_generation() != presence_queue_generation)
+    {
+        presence_queue_generation = downloader.queue_generation();
+        db->clear_presence();
+    }
+
     if (input)
     {
         if (input->active & PKGI_BUTTON_UP)
@@ -460,7 +481,7 @@ void pkgi_do_main(Downloader& downloader, pkgi_input* input)
 
         uint32_t color = PKGI_COLOR_TEXT;
 
-        const auto titleid = item->titleid.c_str();
+        const auto titleid = item->titleid.data();
 
         if (item->presence == PresenceUnknown)
         {
@@ -474,28 +495,27 @@ void pkgi_do_main(Downloader& downloader, pkgi_input* input)
                     item->presence = PresenceInstalling;
                 break;
             case ModePsmGames:
-                if (pkgi_psm_is_installed(titleid))
+                if (presence.psm_installed(titleid))
                     item->presence = PresenceInstalled;
                 else if (downloader.is_in_queue(PsmGame, item->content))
                     item->presence = PresenceInstalling;
                 break;
             case ModePspDlcs:
-                if (pkgi_psp_is_installed(
-                            pkgi_get_mode_partition(), item->content.c_str()))
+                if (presence.psp_installed(item->content))
                     item->presence = PresenceGamePresent;
                 else if (downloader.is_in_queue(PspGame, item->content))
                     item->presence = PresenceInstalling;
                 break;
             case ModePspGames:
-                if (pkgi_psp_is_installed(
-                            pkgi_get_mode_partition(), item->content.c_str()))
+                if (presence.psp_installed(item->content))
                     item->presence = PresenceInstalled;
                 else if (downloader.is_in_queue(PspGame, item->content))
                     item->presence = PresenceInstalling;
                 break;
             case ModePsxGames:
-                if (pkgi_psx_is_installed(
-                            pkgi_get_mode_partition(), item->content.c_str()))
+                if (presence.psx_installed(item->content) ||
+                    pkgi_is_psx_game_installed_titleid(
+                            std::string(item->content.data() + 7, 9)))
                     item->presence = PresenceInstalled;
                 else if (downloader.is_in_queue(PsxGame, item->content))
                     item->presence = PresenceInstalling;
@@ -503,13 +523,13 @@ void pkgi_do_main(Downloader& downloader, pkgi_input* input)
             case ModeDlcs:
                 if (downloader.is_in_queue(Dlc, item->content))
                     item->presence = PresenceInstalling;
-                else if (pkgi_dlc_is_installed(item->content.c_str()))
+                else if (presence.dlc_installed(item->content))
                     item->presence = PresenceInstalled;
                 else if (pkgi_is_installed(titleid))
                     item->presence = PresenceGamePresent;
                 break;
             case ModeThemes:
-                if (pkgi_theme_is_installed(item->content))
+                if (presence.theme_installed(item->content))
                     item->presence = PresenceInstalled;
                 else if (pkgi_is_installed(titleid))
                     item->presence = PresenceGamePresent;
@@ -518,8 +538,8 @@ void pkgi_do_main(Downloader& downloader, pkgi_input* input)
 
             if (item->presence == PresenceUnknown)
             {
-                if (pkgi_is_incomplete(
-                            pkgi_get_mode_partition(), item->content.c_str()))
+                if (presence.incomplete(
+                            pkgi_get_mode_partition(), item->content))
                     item->presence = PresenceIncomplete;
                 else
                     item->presence = PresenceMissing;
@@ -586,6 +606,10 @@ void pkgi_do_main(Downloader& downloader, pkgi_input* input)
         {
             pkgi_draw_text(col_installed, y, color, PKGI_UTF8_INSTALLING);
         }
+        if (mode == ModeGames && (comppack_db_games->contains(item->titleid) ||
+                                  comppack_db_updates->contains(item->titleid)))
+            pkgi_draw_text(
+                    col_comppack, y, PKGI_COLOR_COMPPACK, PKGI_UTF8_COMPPACK);
         pkgi_draw_text(
                 VITA_WIDTH - PKGI_MAIN_SCROLL_WIDTH - PKGI_MAIN_SCROLL_PADDING -
                         sizew,
@@ -600,7 +624,15 @@ void pkgi_do_main(Downloader& downloader, pkgi_input* input)
                 VITA_WIDTH - PKGI_MAIN_SCROLL_WIDTH - PKGI_MAIN_SCROLL_PADDING -
                         PKGI_MAIN_COLUMN_PADDING - sizew - col_name,
                 line_height);
-        pkgi_draw_text(col_name, y, color, item->name.c_str());
+        // titles added or changed by the last refresh of the list
+        uint32_t name_color = color;
+        if (item->flags & DbItemBadZrif)
+            name_color = PKGI_COLOR_TEXT_ERROR;
+        else if (item->flags & DbItemNew)
+            name_color = PKGI_COLOR_TEXT_NEW;
+        else if (item->flags & DbItemUpdated)
+            name_color = PKGI_COLOR_TEXT_UPDATED;
+        pkgi_draw_text(col_name, y, name_color, item->name.data());
         pkgi_clip_remove();
 
         y += font_height + PKGI_MAIN_ROW_PADDING;
@@ -669,8 +701,8 @@ void pkgi_do_main(Downloader& downloader, pkgi_input* input)
                     &config,
                     &downloader,
                     item,
-                    comppack_db_games->get(item->titleid),
-                    comppack_db_updates->get(item->titleid));
+                    comppack_db_games->find(item->titleid),
+                    comppack_db_updates->find(item->titleid));
         else if (mode == ModeThemes || mode == ModeDemos)
         {
             pkgi_start_download(downloader, *item);
@@ -705,23 +737,42 @@ void pkgi_do_main(Downloader& downloader, pkgi_input* input)
 
 void pkgi_do_refresh(void)
 {
-    std::string text;
+    std::vector<Refresher::Status> status;
+    {
+        std::lock_guard<Mutex> lock(refresh_mutex);
+        if (refresher)
+            status = refresher->get_status();
+    }
 
-    uint32_t updated;
-    uint32_t total;
-    db->get_update_status(&updated, &total);
+    const auto done = std::count_if(
+            status.begin(),
+            status.end(),
+            [](const auto& s)
+            {
+                return s.state == Refresher::Status::Done ||
+                       s.state == Refresher::Status::Failed;
+            });
 
-    if (total == 0)
-        text = fmt::format("{}...", current_action);
-    else
-        text = fmt::format("{}... {}%", current_action, updated * 100 / total);
+    std::vector<std::string> lines;
+    lines.push_back(fmt::format("Refrescando [{}/{}]...", done, status.size()));
+    for (const auto& s : status)
+    {
+        if (s.state != Refresher::Status::Running)
+            continue;
+        if (s.total == 0)
+            lines.push_back(fmt::format("{}...", s.name));
+        else
+            lines.push_back(fmt::format(
+                    "{}... {}%", s.name, s.downloaded * 100 / s.total));
+    }
 
-    int w = pkgi_text_width(text.c_str());
-    pkgi_draw_text(
-            (VITA_WIDTH - w) / 2,
-            VITA_HEIGHT / 2,
-            PKGI_COLOR_TEXT,
-            text.c_str());
+    int y = VITA_HEIGHT / 2 - font_height * (lines.size() / 2);
+    for (const auto& text : lines)
+    {
+        int w = pkgi_text_width(text.c_str());
+        pkgi_draw_text((VITA_WIDTH - w) / 2, y, PKGI_COLOR_TEXT, text.c_str());
+        y += font_height;
+    }
 }
 
 void pkgi_do_head(void)
@@ -1023,6 +1074,16 @@ void pkgi_open_db()
     }
 
     pkgi_reload();
+
+    preload_modes.clear();
+    for (int i = 0; i < ModeCount; ++i)
+    {
+        const auto preload_mode = static_cast<Mode>(i);
+        if (preload_mode != mode &&
+            !pkgi_get_url_from_mode(preload_mode).empty())
+            preload_modes.push_back(preload_mode);
+    }
+    pkgi_start_thread("preload_thread", &pkgi_preload_thread);
 }
 }
 
@@ -1069,7 +1130,7 @@ void pkgi_start_download(Downloader& downloader, const DbItem& item)
         uint8_t rif[PKGI_PSM_RIF_SIZE];
         char message[256];
         if (item.zrif.empty() ||
-            pkgi_zrif_decode(item.zrif.c_str(), rif, message, sizeof(message)))
+            pkgi_zrif_decode(item.zrif.data(), rif, message, sizeof(message)))
         {
             if ( 
                 mode == ModeGames || mode == ModeDlcs || mode == ModeDemos || mode == ModeThemes || // Vita contents
@@ -1079,13 +1140,13 @@ void pkgi_start_download(Downloader& downloader, const DbItem& item)
             {
 
                 if (MODE_IS_PSPEMU(mode)) {
-                    pkgi_create_psp_rif(item.content, rif);
+                    pkgi_create_psp_rif(std::string(item.content), rif);
                 }
                 
                 pkgi_start_bgdl(
                         mode_to_bgdl_type(mode),
-                        item.name,
-                        item.url,
+                        std::string(item.name),
+                        std::string(item.url),
                         std::vector<uint8_t>(rif, rif + PKGI_PSM_RIF_SIZE));
                 pkgi_dialog_message(
                         fmt::format(
@@ -1096,17 +1157,17 @@ void pkgi_start_download(Downloader& downloader, const DbItem& item)
             else {
                 downloader.add(DownloadItem{
                         mode_to_type(mode),
-                        item.name,
-                        item.content,
-                        item.url,
+                        std::string(item.name),
+                        std::string(item.content),
+                        std::string(item.url),
                         item.zrif.empty()
                                 ? std::vector<uint8_t>{}
                                 : std::vector<uint8_t>(
                                           rif, rif + PKGI_PSM_RIF_SIZE),
-                        item.has_digest ? std::vector<uint8_t>(
-                                                  item.digest.begin(),
-                                                  item.digest.end())
-                                        : std::vector<uint8_t>{},
+                        item.digest ? std::vector<uint8_t>(
+                                              item.digest,
+                                              item.digest + SHA256_DIGEST_SIZE)
+                                    : std::vector<uint8_t>{},
                         !config.install_psp_as_pbp,
                         pkgi_get_mode_partition(),
                         ""});
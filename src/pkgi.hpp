@@ -67,7 +67,6 @@ int pkgi_battery_is_charging();
 
 uint64_t pkgi_get_free_space(const char*);
 const char* pkgi_get_config_folder(void);
-int pkgi_is_incomplete(const char* partition, const char* titleid);
 
 uint32_t pkgi_time_msec();
 
@@ -0,0 +1,168 @@
+#include "presence.hpp"
+
+#include "file.hpp"
+#include "log.hpp"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <cctype>
+
+namespace
+{
+constexpr std::string_view RESUME_SUFFIX = ".resume";
+constexpr std::string_view ISO_SUFFIX = ".iso";
+
+bool ends_with(std::string_view str, std::string_view suffix)
+{
+    return str.size() >= suffix.size() &&
+           str.substr(str.size() - suffix.size()) == suffix;
+}
+
+// the pspemu folders are on a case insensitive filesystem
+bool ends_with_nocase(std::string_view str, std::string_view suffix)
+{
+    return str.size() >= suffix.size() &&
+           std::equal(
+                   suffix.begin(),
+                   suffix.end(),
+                   str.end() - suffix.size(),
+                   [](char a, char b)
+                   {
+                       return std::tolower(static_cast<unsigned char>(a)) ==
+                              std::tolower(static_cast<unsigned char>(b));
+                   });
+}
+
+// title ids in content ids are uppercase
+std::string to_upper(std::string str)
+{
+    for (auto& c : str)
+        c = std::toupper(static_cast<unsigned char>(c));
+    return str;
+}
+
+bool contains(
+        const std::unordered_set<std::string>& set, std::string_view key)
+{
+    return set.find(std::string(key)) != set.end();
+}
+
+// title id of a content id, empty if content is too short
+std::string_view content_titleid(std::string_view content)
+{
+    return content.size() < 16 ? std::string_view() : content.substr(7, 9);
+}
+}
+
+void PresenceIndex::scan(
+        const std::string& partition, const std::string& psp_partition)
+{
+    _games.clear();
+    _psm_games.clear();
+    _dlcs.clear();
+    _themes.clear();
+    _psp_folders.clear();
+    _psp_eboots.clear();
+    _psp_isos.clear();
+    _incomplete.clear();
+
+    for (auto& game : pkgi_list_dir_contents(partition + "app"))
+        _games.insert(std::move(game));
+
+    for (auto& game : pkgi_list_dir_contents(partition + "psm"))
+        _psm_games.insert(std::move(game));
+
+    const auto addcont = partition + "addcont";
+    for (const auto& titleid : pkgi_list_dir_contents(addcont))
+        for (const auto& dlc :
+             pkgi_list_dir_contents(fmt::format("{}/{}", addcont, titleid)))
+            _dlcs.insert(fmt::format("{}/{}", titleid, dlc));
+
+    for (auto& theme : pkgi_list_dir_contents(partition + "theme"))
+        _themes.insert(std::move(theme));
+
+    const auto psp_games = psp_partition + "pspemu/PSP/GAME";
+    for (auto& folder : pkgi_list_dir_contents(psp_games))
+    {
+        if (pkgi_file_exists(
+                    fmt::format("{}/{}/EBOOT.PBP", psp_games, folder)))
+            _psp_eboots.insert(to_upper(folder));
+        _psp_folders.insert(to_upper(std::move(folder)));
+    }
+
+    for (const auto& iso :
+         pkgi_list_dir_contents(psp_partition + "pspemu/ISO"))
+        if (ends_with_nocase(iso, ISO_SUFFIX))
+            _psp_isos.insert(to_upper(
+                    iso.substr(0, iso.size() - ISO_SUFFIX.size())));
+
+    scan_downloads(partition);
+    if (psp_partition != partition)
+        scan_downloads(psp_partition);
+
+    LOGF("contenido instalado: {} juegos, {} DLCs, {} temas, {} PSM, {} "
+         "PSP/PS1, {} descargas incompletas",
+         _games.size(),
+         _dlcs.size(),
+         _themes.size(),
+         _psm_games.size(),
+         _psp_folders.size() + _psp_isos.size(),
+         _incomplete.size());
+}
+
+void PresenceIndex::scan_downloads(const std::string& partition)
+{
+    for (const auto& file : pkgi_list_dir_contents(partition + "pkgj"))
+        if (ends_with(file, RESUME_SUFFIX))
+            _incomplete.insert(
+                    partition +
+                    file.substr(0, file.size() - RESUME_SUFFIX.size()));
+}
+
+bool PresenceIndex::game_installed(std::string_view titleid) const
+{
+    return contains(_games, titleid);
+}
+
+bool PresenceIndex::psm_installed(std::string_view titleid) const
+{
+    return contains(_psm_games, titleid);
+}
+
+bool PresenceIndex::dlc_installed(std::string_view content) const
+{
+    if (content.size() < 36)
+        return false;
+    return contains(
+            _dlcs,
+            fmt::format("{}/{}", content.substr(7, 9), content.substr(20, 16)));
+}
+
+bool PresenceIndex::theme_installed(std::string_view content) const
+{
+    if (content.size() < 19)
+        return false;
+    // the folder is the content id without its prefix and the _00 after the
+    // title id
+    return contains(
+            _themes,
+            fmt::format("{}{}", content.substr(7, 9), content.substr(19)));
+}
+
+bool PresenceIndex::psp_installed(std::string_view content) const
+{
+    const auto titleid = content_titleid(content);
+    return contains(_psp_isos, titleid) || contains(_psp_eboots, titleid);
+}
+
+bool PresenceIndex::psx_installed(std::string_view content) const
+{
+    return contains(_psp_folders, content_titleid(content));
+}
+
+bool PresenceIndex::incomplete(
+        std::string_view partition, std::string_view content) const
+{
+    return contains(_incomplete, fmt::format("{}{}", partition, content));
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <unordered_set>
+
+// Content installed on the memory card, found by listing the install folders
+// once. Checking whether a row of the list is installed is then a hash lookup
+// instead of file probes. It must be scanned again after an install.
+class PresenceIndex
+{
+public:
+    // partition holds the vita content (usually "ux0:"), psp_partition the
+    // pspemu folder and the downloads of psp and ps1 content
+    void scan(const std::string& partition, const std::string& psp_partition);
+
+    // title ids of the games in app
+    const std::unordered_set<std::string>& games() const
+    {
+        return _games;
+    }
+
+    bool game_installed(std::string_view titleid) const;
+    bool psm_installed(std::string_view titleid) const;
+
+    // the functions below take content ids
+    bool dlc_installed(std::string_view content) const;
+    bool theme_installed(std::string_view content) const;
+    bool psp_installed(std::string_view content) const;
+    bool psx_installed(std::string_view content) const;
+    // a download of content into partition was interrupted
+    bool incomplete(std::string_view partition, std::string_view content)
+            const;
+
+private:
+    std::unordered_set<std::string> _games;
+    std::unordered_set<std::string> _psm_games;
+    // title id/dlc folder
+    std::unordered_set<std::string> _dlcs;
+    // title id-theme id, as named by the theme folders
+    std::unordered_set<std::string> _themes;
+    // folders of PSP/GAME, and those among them with an EBOOT.PBP
+    std::unordered_set<std::string> _psp_folders;
+    std::unordered_set<std::string> _psp_eboots;
+    // title ids of the isos of ISO
+    std::unordered_set<std::string> _psp_isos;
+    // partition followed by content id
+    std::unordered_set<std::string> _incomplete;
+
+    void scan_downloads(const std::string& partition);
+};
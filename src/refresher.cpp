@@ -0,0 +1,92 @@
+#include "refresher.hpp"
+
+#include "log.hpp"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <mutex>
+#include <stdexcept>
+
+Refresher::Refresher(
+        HttpFactory http_factory,
+        std::vector<Source> sources,
+        unsigned worker_count)
+    : _mutex("refresher_mutex")
+    , _http_factory(std::move(http_factory))
+    , _sources(std::move(sources))
+    , _worker_count(worker_count)
+{
+    for (const auto& source : _sources)
+        _status.push_back(Status{source.name, Status::Pending, 0, 0, {}});
+}
+
+void Refresher::run()
+{
+    const auto worker_count = std::max(
+            1u, std::min<unsigned>(_worker_count, _sources.size()));
+
+    {
+        std::vector<std::unique_ptr<Thread>> workers;
+        for (unsigned i = 0; i < worker_count; ++i)
+            workers.push_back(std::make_unique<Thread>(
+                    fmt::format("refresh_worker_{}", i),
+                    [this] { do_work(); }));
+        for (auto& worker : workers)
+            worker->join();
+    }
+
+    std::string errors;
+    for (const auto& status : get_status())
+        if (status.state == Status::Failed)
+            errors += fmt::format("\n{}: {}", status.name, status.error);
+    if (!errors.empty())
+        throw formatEx<std::runtime_error>("fallo al refrescar:{}", errors);
+}
+
+std::vector<Refresher::Status> Refresher::get_status()
+{
+    std::lock_guard<Mutex> lock(_mutex);
+    return _status;
+}
+
+void Refresher::do_work()
+{
+    for (;;)
+    {
+        size_t index;
+        {
+            std::lock_guard<Mutex> lock(_mutex);
+            if (_next_source == _sources.size())
+                return;
+            index = _next_source++;
+            _status[index].state = Status::Running;
+        }
+
+        const auto& source = _sources[index];
+        LOGF("refrescando {}", source.name);
+
+        try
+        {
+            const auto http = _http_factory();
+            source.run(
+                    http.get(),
+                    [&](uint64_t downloaded, uint64_t total)
+                    {
+                        std::lock_guard<Mutex> lock(_mutex);
+                        _status[index].downloaded = downloaded;
+                        _status[index].total = total;
+                    });
+
+            std::lock_guard<Mutex> lock(_mutex);
+            _status[index].state = Status::Done;
+        }
+        catch (const std::exception& e)
+        {
+            LOGF("fallo al refrescar {}: {}", source.name, e.what());
+            std::lock_guard<Mutex> lock(_mutex);
+            _status[index].state = Status::Failed;
+            _status[index].error = e.what();
+        }
+    }
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "http.hpp"
+#include "thread.hpp"
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <cstdint>
+
+// Refreshes several lists at once with a bounded number of workers, each
+// source being downloaded and committed on its own.
+class Refresher
+{
+public:
+    using ProgressCallback =
+            std::function<void(uint64_t downloaded, uint64_t total)>;
+
+    struct Source
+    {
+        std::string name;
+        // downloads the source with http and commits it
+        std::function<void(Http* http, const ProgressCallback& progress)> run;
+    };
+
+    struct Status
+    {
+        enum State
+        {
+            Pending,
+            Running,
+            Done,
+            Failed,
+        };
+
+        std::string name;
+        State state;
+        uint64_t downloaded;
+        uint64_t total;
+        std::string error;
+    };
+
+    using HttpFactory = std::function<std::unique_ptr<Http>()>;
+
+    Refresher(
+            HttpFactory http_factory,
+            std::vector<Source> sources,
+            unsigned worker_count);
+
+    // blocks until every source is done, throws if one of them failed
+    void run();
+
+    std::vector<Status> get_status();
+
+private:
+    Mutex _mutex;
+
+    HttpFactory _http_factory;
+    std::vector<Source> _sources;
+    unsigned _worker_count;
+
+    std::vector<Status> _status;
+    size_t _next_source{0};
+
+    void do_work();
+};
@@ -95,6 +95,14 @@ int pkgi_is_unsafe_mode(void)
     return 1;
 }
 
+int64_t pkgi_get_size(const char* path)
+{
+    struct stat s;
+    if (stat(path, &s) < 0)
+        return -1;
+    return s.st_size;
+}
+
 bool pkgi_file_exists(const std::string& path)
 {
     struct stat s;
@@ -191,6 +199,31 @@ void pkgi_delete_dir(const std::string& path)
                 "fallo rmdir({}): {}", path, strerror(errno));
 }
 
+std::vector<std::string> pkgi_list_dir_contents(const std::string& path)
+{
+    DIR* dfd = opendir(path.c_str());
+    if (!dfd && errno == ENOENT)
+        return {};
+
+    if (!dfd)
+        throw formatEx<std::runtime_error>(
+                "fallo al abrir({}): {}", path, strerror(errno));
+
+    BOOST_SCOPE_EXIT_ALL(&)
+    {
+        closedir(dfd);
+    };
+
+    std::vector<std::string> out;
+    while (const auto dir = readdir(dfd))
+    {
+        const std::string d_name = dir->d_name;
+        if (d_name != "." && d_name != "..")
+            out.push_back(d_name);
+    }
+    return out;
+}
+
 std::vector<uint8_t> pkgi_load(const std::string& path)
 {
     int fd = open(path.c_str(), O_RDONLY);
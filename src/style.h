@@ -13,6 +13,7 @@
 #define PKGI_UTF8_INSTALLING "\xe2\x96\xb6" // 0x25b6
 #define PKGI_UTF8_INSTALLED "\xe2\x97\x8f" // 0x25cf
 #define PKGI_UTF8_PARTIAL "\xe2\x97\x8b" // 0x25cb
+#define PKGI_UTF8_COMPPACK "\xe2\x96\xa0" // 0x25a0
 #define PKGI_COLOR_GAME_PRESENT PKGI_COLOR(50, 50, 255)
 
 #define PKGI_UTF8_B "B"
@@ -37,6 +38,9 @@
 #define PKGI_COLOR_TEXT_TAIL PKGI_COLOR(255, 255, 255)
 #define PKGI_COLOR_TEXT_DIALOG PKGI_COLOR(255, 255, 255)
 #define PKGI_COLOR_TEXT_ERROR PKGI_COLOR(255, 50, 50)
+#define PKGI_COLOR_TEXT_NEW PKGI_COLOR(255, 220, 0)
+#define PKGI_COLOR_TEXT_UPDATED PKGI_COLOR(0, 200, 255)
+#define PKGI_COLOR_COMPPACK PKGI_COLOR(255, 150, 0)
 #define PKGI_COLOR_HLINE PKGI_COLOR(200, 200, 200)
 #define PKGI_COLOR_SCROLL_BAR PKGI_COLOR(255, 255, 255)
 #define PKGI_COLOR_BATTERY_LOW PKGI_COLOR(255, 50, 50)
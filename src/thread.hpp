@@ -2,7 +2,13 @@
 
 #include "pkgi.hpp"
 
+#ifdef __vita__
 #include <psp2/kernel/threadmgr.h>
+#else
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
 
 #include <functional>
 #include <memory>
@@ -27,6 +33,8 @@ public:
     }
 };
 
+#ifdef __vita__
+
 class Mutex
 {
 public:
@@ -227,3 +235,120 @@ private:
         return 0;
     }
 };
+
+#else
+
+// host builds (pkgj_cli) use the standard library with the same interface
+
+class Mutex
+{
+public:
+    Mutex(const Mutex&) = delete;
+    Mutex(Mutex&&) = delete;
+    Mutex& operator=(const Mutex&) = delete;
+    Mutex& operator=(Mutex&&) = delete;
+
+    Mutex(const std::string&)
+    {
+    }
+
+    void lock()
+    {
+        _mutex.lock();
+    }
+
+    bool try_lock()
+    {
+        return _mutex.try_lock();
+    }
+
+    void unlock()
+    {
+        _mutex.unlock();
+    }
+
+private:
+    std::mutex _mutex;
+};
+
+class Cond
+{
+public:
+    Cond(const Cond&) = delete;
+    Cond(Cond&&) = delete;
+    Cond& operator=(const Cond&) = delete;
+    Cond& operator=(Cond&&) = delete;
+
+    Cond(const std::string& name) : _mutex(name + "_mutex")
+    {
+    }
+
+    void notify_one()
+    {
+        _cond.notify_one();
+    }
+
+    // like on the vita, the mutex must be locked
+    void wait()
+    {
+        _cond.wait(_mutex);
+    }
+
+    Mutex& get_mutex()
+    {
+        return _mutex;
+    }
+
+private:
+    Mutex _mutex;
+    std::condition_variable_any _cond;
+};
+
+class Thread
+{
+public:
+    using EntryPoint = std::function<void()>;
+
+    Thread(const Thread&) = delete;
+    Thread(Thread&&) = delete;
+    Thread& operator=(const Thread&) = delete;
+    Thread& operator=(Thread&&) = delete;
+
+    Thread(const std::string&, EntryPoint entry)
+        : _thread(&entry_point, std::move(entry))
+    {
+    }
+
+    ~Thread()
+    {
+        if (_thread.joinable())
+            _thread.detach();
+    }
+
+    void join()
+    {
+        _thread.join();
+    }
+
+private:
+    std::thread _thread;
+
+    static void entry_point(EntryPoint entry)
+    {
+        try
+        {
+            entry();
+            LOG("thread terminado con exito");
+        }
+        catch (const std::exception& e)
+        {
+            LOG("excepcion obtenida del hilo: %s", e.what());
+        }
+        catch (...)
+        {
+            LOG("excepcion desconocida del hilo");
+        }
+    }
+};
+
+#endif
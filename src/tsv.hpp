@@ -0,0 +1,112 @@
+#pragma once
+
+#include <array>
+#include <string_view>
+
+#include <cstddef>
+#include <cstdint>
+
+#if __ARM_NEON__
+#include <arm_neon.h>
+#elif __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Fields of a row of a tab-separated list, as views into the row. The row
+// itself is left untouched.
+class TsvRow
+{
+public:
+    // fields past the last one are kept in it, tabs included
+    static constexpr unsigned MaxFields = 16;
+
+    void start(const char* begin)
+    {
+        _starts[0] = begin;
+        _count = 1;
+    }
+
+    // field starts right after a delimiter
+    void add(const char* field)
+    {
+        if (_count < MaxFields)
+            _starts[_count++] = field;
+    }
+
+    // end is the position of the line feed ending the row, or the end of
+    // the data
+    void finish(const char* end)
+    {
+        _starts[_count] = end + 1;
+    }
+
+    unsigned size() const
+    {
+        return _count;
+    }
+
+    std::string_view operator[](unsigned i) const
+    {
+        return std::string_view(
+                _starts[i], _starts[i + 1] - _starts[i] - 1);
+    }
+
+private:
+    std::array<const char*, MaxFields + 1> _starts;
+    unsigned _count = 0;
+};
+
+// first tab, carriage return or line feed in [ptr, end), end if there is
+// none
+inline const char* pkgi_find_tsv_delimiter(const char* ptr, const char* end)
+{
+#if __ARM_NEON__
+    const auto tab = vdupq_n_u8('\t');
+    const auto cr = vdupq_n_u8('\r');
+    const auto lf = vdupq_n_u8('\n');
+    for (; end - ptr >= 16; ptr += 16)
+    {
+        const auto v = vld1q_u8(reinterpret_cast<const uint8_t*>(ptr));
+        const auto match = vorrq_u8(
+                vorrq_u8(vceqq_u8(v, tab), vceqq_u8(v, cr)), vceqq_u8(v, lf));
+        // there is no movemask on ARMv7, the matching byte is found by the
+        // loop below
+        const auto folded = vreinterpret_u32_u8(
+                vorr_u8(vget_low_u8(match), vget_high_u8(match)));
+        if (vget_lane_u32(vpmax_u32(folded, folded), 0))
+            break;
+    }
+#elif __SSE2__
+    const auto tab = _mm_set1_epi8('\t');
+    const auto cr = _mm_set1_epi8('\r');
+    const auto lf = _mm_set1_epi8('\n');
+    for (; end - ptr >= 16; ptr += 16)
+    {
+        const auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr));
+        const auto match = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(v, tab), _mm_cmpeq_epi8(v, cr)),
+                _mm_cmpeq_epi8(v, lf));
+        const auto mask = _mm_movemask_epi8(match);
+        if (mask)
+            return ptr + __builtin_ctz(mask);
+    }
+#endif
+    for (; ptr != end; ++ptr)
+        if (*ptr == '\t' || *ptr == '\r' || *ptr == '\n')
+            break;
+    return ptr;
+}
+
+// splits the row [begin, end) on tabs and carriage returns
+inline void pkgi_split_tsv_row(const char* begin, const char* end, TsvRow& row)
+{
+    row.start(begin);
+    for (const char* ptr = begin;; ++ptr)
+    {
+        ptr = pkgi_find_tsv_delimiter(ptr, end);
+        if (ptr == end)
+            break;
+        row.add(ptr + 1);
+    }
+    row.finish(end);
+}
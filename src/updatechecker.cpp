@@ -0,0 +1,54 @@
+#include "updatechecker.hpp"
+
+#include "log.hpp"
+
+#include <optional>
+#include <stdexcept>
+
+UpdateCheck pkgi_check_updates(
+        const Refresher::HttpFactory& http_factory,
+        PatchInfoCache& cache,
+        const std::vector<std::string>& titleids,
+        const std::function<std::string(const std::string& titleid)>&
+                installed_version,
+        unsigned worker_count)
+{
+    // one slot per title, each written by a single worker
+    std::vector<std::optional<TitleUpdate>> updates(titleids.size());
+
+    std::vector<Refresher::Source> sources;
+    for (size_t i = 0; i < titleids.size(); ++i)
+        sources.push_back(Refresher::Source{
+                titleids[i],
+                [&, i](Http* http, const Refresher::ProgressCallback&)
+                {
+                    const auto& titleid = titleids[i];
+                    auto version = installed_version(titleid);
+                    if (version.empty())
+                        return;
+                    auto patch = cache.get(http, titleid);
+                    // versions are all written as NN.NN
+                    if (patch && patch->version > version)
+                        updates[i] = TitleUpdate{
+                                titleid, std::move(version), std::move(*patch)};
+                }});
+
+    Refresher refresher(http_factory, std::move(sources), worker_count);
+    try
+    {
+        refresher.run();
+    }
+    catch (const std::exception& e)
+    {
+        LOGF("fallo al buscar actualizaciones: {}", e.what());
+    }
+
+    UpdateCheck check;
+    for (auto& update : updates)
+        if (update)
+            check.updates.push_back(std::move(*update));
+    for (const auto& status : refresher.get_status())
+        if (status.state == Refresher::Status::Failed)
+            check.errors.push_back(status.name + ": " + status.error);
+    return check;
+}
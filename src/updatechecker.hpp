@@ -0,0 +1,35 @@
+#pragma once
+
+#include "patchinfo.hpp"
+#include "refresher.hpp"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+struct TitleUpdate
+{
+    std::string titleid;
+    std::string installed_version;
+    PatchInfo patch;
+};
+
+struct UpdateCheck
+{
+    // titles whose last patch is newer than the installed version, in the
+    // order they were given
+    std::vector<TitleUpdate> updates;
+    // "titleid: error" for the titles that couldn't be checked
+    std::vector<std::string> errors;
+};
+
+// Checks the patch info of all titleids through cache, with at most
+// worker_count requests at once. installed_version gives the version of a
+// title, pkgi_get_game_version on the vita, titles without one are skipped.
+UpdateCheck pkgi_check_updates(
+        const Refresher::HttpFactory& http_factory,
+        PatchInfoCache& cache,
+        const std::vector<std::string>& titleids,
+        const std::function<std::string(const std::string& titleid)>&
+                installed_version,
+        unsigned worker_count);
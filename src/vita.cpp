@@ -700,12 +700,6 @@ const char* pkgi_get_config_folder()
     }
 }
 
-int pkgi_is_incomplete(const char* partition, const char* contentid)
-{
-    return pkgi_file_exists(
-            fmt::format("{}pkgj/{}.resume", partition, contentid).c_str());
-}
-
 void pkgi_delete_dir(const std::string& path)
 {
     SceUID dfd = sceIoDopen(path.c_str());
@@ -104,12 +104,23 @@ void VitaHttp::start(const std::string& url, uint64_t offset)
         char range[64];
         pkgi_snprintf(range, sizeof(range), "bytes=%llu-", offset);
         if ((err = sceHttpAddRequestHeader(
-                     req, "Rango", range, SCE_HTTP_HEADER_ADD)) < 0)
+                     req, "Range", range, SCE_HTTP_HEADER_ADD)) < 0)
             throw HttpError(fmt::format(
                     "Fallo sceHttpAddRequestHeader: {:#08x}",
                     static_cast<uint32_t>(err)));
     }
 
+    for (const auto& header : _request_headers)
+        if ((err = sceHttpAddRequestHeader(
+                     req,
+                     header.first.c_str(),
+                     header.second.c_str(),
+                     SCE_HTTP_HEADER_ADD)) < 0)
+            throw HttpError(fmt::format(
+                    "Fallo sceHttpAddRequestHeader: {:#08x}",
+                    static_cast<uint32_t>(err)));
+    _request_headers.clear();
+
     if ((err = sceHttpSendRequest(req, NULL, 0)) < 0)
     {
         std::string err_msg;
@@ -219,10 +230,36 @@ void VitaHttp::check_status()
 
     LOGF("codigo estado http = {}", status);
 
-    if (status != 200 && status != 206)
+    // 304 only comes back to conditional requests
+    if (status != 200 && status != 206 && status != 304)
         throw HttpError(fmt::format("mal estado http: {}", status));
 }
 
+void VitaHttp::add_request_header(
+        const std::string& name, const std::string& value)
+{
+    _request_headers.emplace_back(name, value);
+}
+
+std::string VitaHttp::get_response_header(const std::string& name)
+{
+    char* headers;
+    unsigned int headers_size;
+    int res;
+    if ((res = sceHttpGetAllResponseHeaders(
+                 _http->req, &headers, &headers_size)) < 0)
+        throw HttpError(fmt::format(
+                "Fallo sceHttpGetAllResponseHeaders: {:#08x}",
+                static_cast<uint32_t>(res)));
+
+    const char* value;
+    unsigned int value_size;
+    if (sceHttpParseResponseHeader(
+                headers, headers_size, name.c_str(), &value, &value_size) < 0)
+        return {};
+    return std::string(value, value_size);
+}
+
 VitaHttp::operator bool() const
 {
     return _http;
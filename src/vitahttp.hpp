@@ -3,6 +3,10 @@
 #include "http.hpp"
 #include "pkgi.hpp"
 
+#include <string>
+#include <utility>
+#include <vector>
+
 struct pkgi_http;
 
 class VitaHttp : public Http
@@ -17,11 +21,16 @@ public:
     int get_status() override;
     int64_t get_length() override;
 
+    void add_request_header(
+            const std::string& name, const std::string& value) override;
+    std::string get_response_header(const std::string& name) override;
+
     explicit operator bool() const override;
 
 private:
     pkgi_http* _http = nullptr;
     bool _status_checked = false;
+    std::vector<std::pair<std::string, std::string>> _request_headers;
 
     void check_status();
 };
@@ -9,6 +9,9 @@ extern "C"
 #include <cstring>
 
 #define ADLER32_MOD 65521
+// largest number of bytes whose sums can't overflow 32 bits before the
+// modulo, see zlib
+#define ADLER32_NMAX 5552
 
 #define ZLIB_DEFLATE_METHOD 8
 #define ZLIB_DICTIONARY_ID_ZRIF 0x627d1d5d
@@ -100,10 +103,38 @@ static uint32_t adler32(const uint8_t* data, size_t size)
     uint32_t a = 1;
     uint32_t b = 0;
 
-    for (size_t i = 0; i < size; i++)
+    while (size > 0)
     {
-        a = (a + data[i]) % ADLER32_MOD;
-        b = (b + a) % ADLER32_MOD;
+        size_t block = size < ADLER32_NMAX ? size : ADLER32_NMAX;
+        size -= block;
+
+        for (; block >= 8; block -= 8, data += 8)
+        {
+            a += data[0];
+            b += a;
+            a += data[1];
+            b += a;
+            a += data[2];
+            b += a;
+            a += data[3];
+            b += a;
+            a += data[4];
+            b += a;
+            a += data[5];
+            b += a;
+            a += data[6];
+            b += a;
+            a += data[7];
+            b += a;
+        }
+        for (; block > 0; block--)
+        {
+            a += *data++;
+            b += a;
+        }
+
+        a %= ADLER32_MOD;
+        b %= ADLER32_MOD;
     }
 
     return (b << 16) | a;
@@ -219,6 +250,14 @@ int pkgi_zrif_decode(
         const char* str, uint8_t* rif, char* error, uint32_t error_size)
 {
     uint8_t raw[1024];
+
+    const size_t size = strlen(str);
+    if (size == 0 || size > sizeof(raw) / 3 * 4)
+    {
+        strncpy(error, "Tam. equivocado de zRIF, esta corrupto?", error_size);
+        return 0;
+    }
+
     uint32_t len = base64_decode(str, raw);
 
     uint8_t out[1024 + sizeof(zrif_dict)];